@@ -0,0 +1,81 @@
+#include "arena.h"
+#include "common.h"
+
+/* See `arena.h` for documentation. */
+
+enum { CHUNK_SIZE = 1 << 16 };
+
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size;
+    char data[];
+};
+
+
+
+void arena_init(struct arena *a) {
+    *a = (struct arena){ .chunk = NULL, .used = 0, .pending = 0 };
+}
+
+
+
+void arena_free(struct arena *a) {
+    while (a->chunk) {
+        struct arena_chunk *c = a->chunk;
+        a->chunk = c->prev;
+        free(c);
+    }
+    arena_init(a);
+}
+
+
+
+/* Make room for `n` more bytes after the pending string, moving it to
+   a new chunk if necessary. */
+
+static void reserve(struct arena *a, size_t n) {
+
+    if (a->chunk && a->used + a->pending + n <= a->chunk->size)
+        return;
+
+    size_t size = max((size_t)CHUNK_SIZE, 2 * (a->pending + n));
+    struct arena_chunk *c = _new(sizeof(struct arena_chunk) + size);
+    c->prev = a->chunk;
+    c->size = size;
+    if (a->pending)
+        memcpy(c->data, a->chunk->data + a->used, a->pending);
+
+    a->chunk = c;
+    a->used = 0;
+}
+
+
+
+void arena_add(struct arena *a, char c) {
+    reserve(a, 2); // leave room for the terminator
+    a->chunk->data[a->used + a->pending++] = c;
+}
+
+
+
+char *arena_str(struct arena *a) {
+    reserve(a, 1);
+    char *s = a->chunk->data + a->used;
+    s[a->pending] = '\0';
+    return s;
+}
+
+
+
+char *arena_keep(struct arena *a) {
+    char *s = arena_str(a);
+    a->used += a->pending + 1;
+    a->pending = 0;
+    return s;
+}
+
+
+
+void arena_drop(struct arena *a) {
+    a->pending = 0;
+}
@@ -0,0 +1,50 @@
+/* A string arena: Many small strings allocated in few large chunks,
+   and freed all at once.  Strings never move, so pointers to them stay
+   valid until the arena is freed.
+
+   Strings are built one character at a time.  The string under
+   construction is pending: It can be inspected, and then either be kept
+   or be dropped, without any allocation in the latter case. */
+
+#ifndef arena_Wc5tJr9NqLxe
+#define arena_Wc5tJr9NqLxe
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunk; // current chunk, linked to older ones
+    size_t used; // bytes in current chunk taken by kept strings
+    size_t pending; // length of the pending string, following those
+};
+
+/* Initialise an empty arena.  No memory is allocated yet. */
+
+void arena_init(struct arena *a);
+
+/* Free all strings in the arena. */
+
+void arena_free(struct arena *a);
+
+/* Append `c` to the pending string.  Terminates the program on
+   failure. */
+
+void arena_add(struct arena *a, char c);
+
+/* Return the pending string, NUL-terminated.  The pointer is valid
+   until the next call to `arena_add`. */
+
+char *arena_str(struct arena *a);
+
+/* Keep the pending string, and return it.  The pointer is valid until
+   the arena is freed.  A new, empty string is pending afterwards. */
+
+char *arena_keep(struct arena *a);
+
+/* Discard the pending string.  A new, empty string is pending
+   afterwards. */
+
+void arena_drop(struct arena *a);
+
+#endif
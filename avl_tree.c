@@ -351,6 +351,35 @@ int avl_lookup(avl_Tree t, avl_Key key, avl_Val *ret) {
 
 
 
+int avl_lookupLE(avl_Tree t, avl_Key key, avl_Key *found, avl_Val *val) {
+
+    Node best = NULL;
+
+    for (Node n = t->root; n; ) {
+        int c = t->cmp(key, n->k);
+        if (c < 0)
+            n = n->l;
+        else {
+            best = n;
+            if (c == 0)
+                break;
+            n = n->r;
+        }
+    }
+
+    if (!best)
+        return 0;
+
+    if (found)
+        *found = best->k;
+    if (val)
+        *val = best->v;
+
+    return 1;
+}
+
+
+
 struct free_ctx {
     avl_VisitorFun const visit;
     avl_State state;
@@ -92,6 +92,14 @@ int avl_lookup(avl_Tree t, avl_Key key, avl_Val *val);
 
 
 
+/* Returns `1` if the tree contains a key that is less than or equal
+   to `key`, `0` otherwise.  Stores the greatest such key in `*found`,
+   and its value in `*val`, if not `NULL`. */
+
+int avl_lookupLE(avl_Tree t, avl_Key key, avl_Key *found, avl_Val *val);
+
+
+
 /* Perform a DFS traversal of the tree, calling the function `visit`
    in the order of sorting.  The provided `state` pointer is handed to
    `visit`.  If `visit` returns any value other than 0, then the
@@ -9,9 +9,23 @@ struct file uninitFile = {
     .srcSize = -1, //
     .mode = 07000000, // FIXME really invalid?
     .nlink = 0,
+    .overlay = NULL,
+    .profile = NULL,
+    .stats = NULL,
+    .plugin = NULL,
+    .param = { .seed = 0, .block = 0, .ratio = 0, .unique = 0, .skew = 0,
+               .fields = NULL, .start = 0, .stride = 1, .offset = 0,
+               .width = 0, .bigEndian = 0, .library = NULL, .args = NULL },
+    .gathered = 0,
+    .def = 0xcbf29ce484222325, // FNV-1a offset basis
+    .ino = 0,
+};
+
+struct stamps uninitStamps = {
     .atime = -1,
     .mtime = -1,
     .ctime = -1,
+    .generation = 0,
 };
 
 
@@ -29,5 +43,13 @@ const char *algorithms[] = {
     [algoRoot] = "root",
     [algoIntegers] = "integers",
     [algoChars] = "chars",
+    [algoXoshiro] = "xoshiro256",
+    [algoMt19937] = "mt19937",
+    [algoCompressible] = "compressible",
+    [algoDedup] = "dedup",
+    [algoCsv] = "csv",
+    [algoJsonl] = "jsonl",
+    [algoSequence] = "sequence",
+    [algoPlugin] = "plugin",
     NULL,
 };
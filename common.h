@@ -3,8 +3,10 @@
 
 
 
+#include "arena.h"
 #include "avl_tree.h"
 #include <err.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -116,16 +118,53 @@ void *_new(size_t size);
 
 
 
+/* Parameters of the `fill` algorithms that take any.  Unused ones are
+   as in `uninitFile`. */
+
+struct params {
+    uint64_t seed; // of pseudo-random content
+    size_t block; // bytes produced independently of others, 0: default
+    double ratio; // of `compressible`, original to compressed size, 0: default
+    size_t unique; // of `dedup`, number of distinct blocks, 0: default
+    double skew; // of `dedup`, exponent of the Zipf distribution, 0: uniform
+    char *fields; // of `csv` and `jsonl`, see `record.h`, NULL: default
+    uint64_t start, stride; // of `sequence`, first item and increment
+    size_t offset; // of `sequence`, bytes to skip
+    unsigned int width; // of `sequence` items, in bits, 0: default
+    int bigEndian; // of `sequence` items
+    char *library, *args; // of `plugin`, its shared object, and what it gets
+};
+
 /* All entries in the file sysytem are of this type.  Currently, no
    directories are supported. */
 
 struct file {
+
+    /* Used by every read, so kept together in the first cache line. */
     ssize_t size; // -1: unknown from config file. <-1: factor of source size.
+    char *srcName; // NULL: generated by algo indicated by srcSize
+    ssize_t srcSize; // -1: unknown from config file.
+    struct overlay *overlay; // data written to the file. NULL: read-only.
+    struct profile *profile; // emulated performance. NULL: full speed.
+    struct stats *stats; // see `stats.h`. NULL: never opened.
+    struct plugin *plugin; // of `fill plugin`, see `plugin.h`. NULL: none.
+    int gathered; // metadata complete, see `otffs_ready`.
     mode_t mode; // 07000000: unknown from config file.
+    struct params param; // of the `fill` algorithm
+
+    /* Used by stat, and when reloading.  Time stamps are apart, see
+       `struct stamps`. */
     nlink_t nlink;
+    uint64_t def; // fingerprint of the definition in the config file.
+    size_t ino; // in its file system, for `stamps`, and for probes.
+};
+
+/* The cold part of an inode, used by stat but never by reads.  Kept in
+   an array of their own, next to the files, see `struct fileSystem`. */
+
+struct stamps {
     time_t atime, mtime, ctime; // -1: unknown from config file.
-    char *srcName; // NULL: generated by algo indicated by srcSize
-    ssize_t srcSize; // -1: unknown from config file.
+    uint64_t generation; // of the inode, see `otffs_adopt`.
 };
 
 /* New file records are initialised from here.  Values not set
@@ -133,12 +172,25 @@ struct file {
    system, or be made up. */
 
 extern struct file uninitFile;
+extern struct stamps uninitStamps;
+
 
 
+/* The inode table is a structure of arrays, all by inode number: The
+   files, which reads use, and their stamps, which only stat uses.
+   Numbers no name refers to are on the free-list, to be reused by the
+   next reload, see `otffs_adopt`. */
 
 struct fileSystem {
-    STACK(struct file *) files;
+    STACK(struct file *) files; // NULL: none
+    STACK(struct stamps) stamps; // of `files`, as many
+    STACK(size_t) free; // inode numbers, reused last in first out
     avl_Tree names;
+    struct arena strings; // file and source names
+    struct image *image; // names and files, see `image.h`. NULL: none
+    int rootFh; // sources are relative to this directory
+    time_t now; // default time stamp
+    uint64_t generation; // of inodes handed out by the last reload
 };
 
 
@@ -146,7 +198,10 @@ struct fileSystem {
 /* The algorithms implemented to generate file contents.  `algoRoot`
    is only for the root directory. */
 
-enum { algoRoot, algoIntegers, algoChars };
+enum {
+    algoRoot, algoIntegers, algoChars, algoXoshiro, algoMt19937,
+    algoCompressible, algoDedup, algoCsv, algoJsonl, algoSequence, algoPlugin
+};
 
 extern const char *algorithms[];
 
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "flight.h"
+#include <pthread.h>
+#include <string.h>
+
+/* See `flight.h` for documentation.
+
+   Every thread has at most one block in flight, so the blocks being
+   produced are few, and kept in a list.  The producer writes right
+   into its own reply, and waits for the others to have copied it
+   before returning. */
+
+struct flight {
+    const struct file *fp;
+    size_t block; // number in the file
+    const char *data; // of the producer, complete once `done`
+    int done;
+    unsigned int readers; // waiting for `data`, or copying it
+    pthread_cond_t cond; // `done` set, or `readers` gone
+    struct flight *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct flight *flights; // in progress
+
+
+
+/* Produce block `block` of `fp` into `buf`, or copy it from the thread
+   producing it already.  Returns 1 if copied. */
+
+static int flight_block(const struct file *fp, struct otffs_cursor *c,
+                        size_t block, char *buf) {
+
+    ERRIF(pthread_mutex_lock(&lock));
+    struct flight *f = flights;
+    while (f && (f->fp != fp || f->block != block))
+        f = f->next;
+
+    if (f) {
+        f->readers++;
+        while (! f->done)
+            ERRIF(pthread_cond_wait(&f->cond, &lock));
+        ERRIF(pthread_mutex_unlock(&lock));
+
+        memcpy(buf, f->data, FLIGHT_BLOCK);
+
+        ERRIF(pthread_mutex_lock(&lock));
+        if (! --f->readers) // only the producer waits now
+            ERRIF(pthread_cond_signal(&f->cond));
+        ERRIF(pthread_mutex_unlock(&lock));
+        return 1;
+    }
+
+    struct flight me = {
+        .fp = fp,
+        .block = block,
+        .data = buf,
+        .done = 0,
+        .readers = 0,
+        .next = flights,
+    };
+    ERRIF(pthread_cond_init(&me.cond, NULL));
+    flights = &me;
+    ERRIF(pthread_mutex_unlock(&lock));
+
+    otffs_fillFrom(fp, -1, c, block * FLIGHT_BLOCK, FLIGHT_BLOCK, buf);
+
+    ERRIF(pthread_mutex_lock(&lock));
+    me.done = 1;
+    struct flight **p = &flights;
+    while (*p != &me)
+        p = &(*p)->next;
+    *p = me.next;
+    if (me.readers)
+        ERRIF(pthread_cond_broadcast(&me.cond));
+    while (me.readers)
+        ERRIF(pthread_cond_wait(&me.cond, &lock));
+    ERRIF(pthread_mutex_unlock(&lock));
+    ERRIF(pthread_cond_destroy(&me.cond));
+    return 0;
+}
+
+
+
+size_t flight_fill(const struct file *fp, struct otffs_cursor *c,
+                   size_t off, size_t len, char *buf) {
+
+    size_t shared = 0;
+    while (len) {
+        size_t block = off / FLIGHT_BLOCK,
+            n = min(len, (block + 1) * FLIGHT_BLOCK - off);
+        if (n < FLIGHT_BLOCK)
+            otffs_fillFrom(fp, -1, c, off, n, buf);
+        else if (flight_block(fp, c, block, buf))
+            shared += n;
+        off += n;
+        len -= n;
+        buf += n;
+    }
+    return shared;
+}
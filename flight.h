@@ -0,0 +1,24 @@
+/* Coalescing of concurrent reads of generated content: When several
+   threads need the same block of the same file at the same time, one
+   of them produces it, and the others wait for it and copy the
+   result.  So producing costs scale with the blocks read at a time,
+   not with the readers reading them. */
+
+#ifndef flight_Vn4cHq7ZwTbe
+#define flight_Vn4cHq7ZwTbe
+
+#include "libotffs.h"
+#include <stddef.h>
+
+enum { FLIGHT_BLOCK = 128 << 10 };
+
+/* Produce [off, off+len) of generated file `fp` into `buf`, like
+   `otffs_fillFrom` with cursor `c`.  Blocks of `FLIGHT_BLOCK` bytes,
+   aligned in the file and wholly requested, are shared with
+   concurrent calls for the same `fp`.  Returns how many bytes were
+   copied from another call instead of produced. */
+
+size_t flight_fill(const struct file *fp, struct otffs_cursor *c,
+                   size_t off, size_t len, char *buf);
+
+#endif
@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "fmap.h"
+#include "image.h"
+#include "overlay.h"
+#include "plugin.h"
+#include "profile.h"
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* See `image.h` for documentation.
+
+   Layout: A header, the file records indexed by inode, the name index,
+   and the strings.  Strings are referred to by offset, and end in NUL.
+   All parts are multiples of 8 bytes, so everything is aligned. */
+
+#define IMAGE_MAGIC "otffsimg"
+#define IMAGE_VERSION 7
+#define IMAGE_NONE UINT64_MAX // no string
+
+enum { fPresent = 1, fWritable = 2, fProfile = 4 };
+
+struct image_header {
+    char magic[8];
+    uint64_t version;
+    uint64_t recordSize; // guards against images of other builds
+    uint64_t files, names, strings; // number of records, names, bytes
+};
+
+struct image_file {
+    int64_t size, srcSize, mtime; // as `struct file`
+    uint64_t srcName; // offset of string, or IMAGE_NONE
+    uint32_t mode, flags;
+    uint64_t rate, every; // as `struct profile`
+    int64_t latency, jitter, stall;
+    struct params param; // as `struct file`, but strings are NULL
+    uint64_t fields, library, args; // offsets of strings, or IMAGE_NONE
+};
+
+struct image_name {
+    uint64_t name; // offset of string
+    uint64_t ino;
+};
+
+struct image {
+    struct mapping m;
+    const struct image_header *h;
+    const struct image_file *file;
+    const struct image_name *index;
+    const char *strings;
+};
+
+
+
+/* Used by `image_compile` to collect the image in memory. */
+
+struct compile_ctx {
+    const struct fileSystem *fs;
+    STACK(struct image_file) file;
+    STACK(struct image_name) index;
+    STACK(char) strings;
+};
+
+static uint64_t addString(struct compile_ctx *ctx, const char *s) {
+    uint64_t off = ctx->strings.used;
+    do {
+        ENOUGH(ctx->strings);
+        PUSH(ctx->strings, *s);
+    } while (*s++);
+    return off;
+}
+
+static int compileFun(char *name, size_t ino, struct compile_ctx *ctx) {
+    const struct file *fp = AT(ctx->fs->files, ino);
+
+    uint64_t off = addString(ctx, name);
+    ENOUGH(ctx->index);
+    PUSH(ctx->index, ((struct image_name){ .name = off, .ino = ino }));
+
+    struct image_file *r = &AT(ctx->file, ino);
+    *r = (struct image_file){
+        .size = fp->size,
+        .srcSize = fp->srcSize,
+        .mtime = AT(ctx->fs->stamps, ino).mtime,
+        .srcName = ! fp->srcName ? IMAGE_NONE
+                 : fp->srcName == name ? off
+                 : addString(ctx, fp->srcName),
+        .mode = fp->mode,
+        .param = fp->param,
+        .fields = fp->param.fields ? addString(ctx, fp->param.fields)
+                : IMAGE_NONE,
+        .library = fp->param.library ? addString(ctx, fp->param.library)
+                 : IMAGE_NONE,
+        .args = fp->param.args ? addString(ctx, fp->param.args)
+              : IMAGE_NONE,
+        .flags = fPresent
+               | (fp->overlay ? fWritable : 0)
+               | (fp->profile ? fProfile : 0),
+    };
+    if (fp->profile) {
+        r->rate = fp->profile->rate;
+        r->every = fp->profile->every;
+        r->latency = fp->profile->latency;
+        r->jitter = fp->profile->jitter;
+        r->stall = fp->profile->stall;
+    }
+    r->param.fields = NULL;
+    r->param.library = NULL;
+    r->param.args = NULL;
+    return 0;
+}
+
+static void writeAll(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        ERRIF(n <= 0);
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+void image_compile(const struct fileSystem *fs, int fd) {
+
+    struct compile_ctx ctx = { .fs = fs };
+    ALLOCATE(ctx.file, fs->files.used + 1);
+    ALLOCATE(ctx.index, avl_size(fs->names) + 1);
+    ALLOCATE(ctx.strings, 1 << 16);
+    ctx.file.used = fs->files.used;
+    memset(ctx.file.array, 0, ctx.file.used * sizeof(*ctx.file.array));
+
+    avl_traverse(fs->names, (avl_VisitorFun)compileFun, &ctx);
+
+    while (ctx.strings.used % 8) {
+        ENOUGH(ctx.strings);
+        PUSH(ctx.strings, '\0');
+    }
+
+    struct image_header h = {
+        .version = IMAGE_VERSION,
+        .recordSize = sizeof(struct image_file),
+        .files = ctx.file.used,
+        .names = ctx.index.used,
+        .strings = ctx.strings.used,
+    };
+    memcpy(h.magic, IMAGE_MAGIC, sizeof(h.magic));
+    writeAll(fd, &h, sizeof(h));
+    writeAll(fd, ctx.file.array, ctx.file.used * sizeof(*ctx.file.array));
+    writeAll(fd, ctx.index.array, ctx.index.used * sizeof(*ctx.index.array));
+    writeAll(fd, ctx.strings.array, ctx.strings.used);
+
+    free(ctx.file.array);
+    free(ctx.index.array);
+    free(ctx.strings.array);
+}
+
+
+
+struct image *image_map(int fd) {
+
+    struct stat sb;
+    ERRIF(fstat(fd, &sb));
+    size_t len = (size_t)sb.st_size;
+
+    struct image_header h;
+    if (len < sizeof(h) || pread(fd, &h, sizeof(h), 0) != sizeof(h)
+        || memcmp(h.magic, IMAGE_MAGIC, sizeof(h.magic)))
+        errx(1, "Not an otffs image");
+    if (h.version != IMAGE_VERSION || h.recordSize != sizeof(struct image_file))
+        errx(1, "Image was compiled by another version of otffs");
+    if (h.files > len || h.names > len || h.strings > len
+        || len != sizeof(h) + h.files * sizeof(struct image_file)
+        + h.names * sizeof(struct image_name) + h.strings)
+        errx(1, "Image is truncated or corrupt");
+
+    struct image *img = new(struct image);
+    fmap_map(&img->m, fd, 0, len);
+    img->h = (const struct image_header *)img->m.buf;
+    img->file = (const struct image_file *)(img->h + 1);
+    img->index = (const struct image_name *)(img->file + h.files);
+    img->strings = (const char *)(img->index + h.names);
+
+    if (h.strings && img->strings[h.strings - 1])
+        errx(1, "Image is truncated or corrupt");
+
+    return img;
+}
+
+
+
+void image_free(struct image *img) {
+    fmap_unmap(&img->m);
+    free(img);
+}
+
+
+
+size_t image_files(const struct image *img) {
+    return img->h->files;
+}
+
+
+
+size_t image_names(const struct image *img) {
+    return img->h->names;
+}
+
+
+
+/* Return the string at `off`, or `NULL`.  Out of range offsets are
+   taken as corruption. */
+
+static char *string(const struct image *img, uint64_t off) {
+    if (off == IMAGE_NONE)
+        return NULL;
+    if (off >= img->h->strings)
+        errx(1, "Image is corrupt: string offset %lu", off);
+    return (char *)img->strings + off; // never written through
+}
+
+struct file *image_file(const struct image *img, size_t ino,
+                        struct stamps *st) {
+
+    if (ino >= img->h->files)
+        return NULL;
+    const struct image_file *r = &img->file[ino];
+    if (! (r->flags & fPresent))
+        return NULL;
+
+    struct file *fp = new(struct file);
+    *fp = uninitFile;
+    fp->ino = ino;
+    fp->size = r->size;
+    fp->srcSize = r->srcSize;
+    fp->srcName = string(img, r->srcName);
+    fp->mode = r->mode;
+    fp->param = r->param;
+    fp->param.fields = string(img, r->fields);
+    fp->param.library = string(img, r->library);
+    fp->param.args = string(img, r->args);
+    *st = uninitStamps;
+    st->mtime = r->mtime;
+    if (! fp->srcName && fp->srcSize == algoPlugin) {
+        const char *why;
+        fp->plugin = plugin_open(fp->param.library, fp->param.args, &why);
+        if (! fp->plugin) {
+            warnx("Cannot load plugin `%s` of inode %zu: %s",
+                  fp->param.library, ino, why);
+            free(fp);
+            return NULL;
+        }
+    }
+    if (r->flags & fWritable)
+        fp->overlay = overlay_new();
+    if (r->flags & fProfile) {
+        fp->profile = profile_new();
+        fp->profile->rate = r->rate;
+        fp->profile->every = r->every;
+        fp->profile->latency = r->latency;
+        fp->profile->jitter = r->jitter;
+        fp->profile->stall = r->stall;
+    }
+    return fp;
+}
+
+
+
+int image_lookup(const struct image *img, const char *name, size_t *ino) {
+    size_t lo = 0, hi = img->h->names;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(name, string(img, img->index[mid].name));
+        if (! c) {
+            *ino = img->index[mid].ino;
+            return 1;
+        }
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return 0;
+}
+
+
+
+int image_traverse(const struct image *img, avl_VisitorFun visit,
+                   avl_State state) {
+    for (size_t i = 0; i < img->h->names; i++) {
+        int r = visit(string(img, img->index[i].name), img->index[i].ino,
+                      state);
+        if (r)
+            return r;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/* Binary images of a file system, for instant startup with huge
+   configs.  An image holds the file table, the strings, and an index
+   of names sorted as by strcmp(3).  It is mapped read-only, so
+   instances serving the same image share it via the page cache, and
+   nothing is parsed or allocated up front: File records are created
+   from the image when first used.
+
+   Images are in native byte order, and are only meant to be used on
+   the machine that compiled them. */
+
+#ifndef image_Tg6nQw2ZxKve
+#define image_Tg6nQw2ZxKve
+
+#include "common.h"
+
+struct image;
+
+/* Write the files and names of `fs`, not yet gathered, to `fd`.
+   Terminates the program on failure. */
+
+void image_compile(const struct fileSystem *fs, int fd);
+
+/* Map the image in `fd`, and return it.  Terminates the program if it
+   is not a valid image. */
+
+struct image *image_map(int fd);
+
+/* Unmap the image. */
+
+void image_free(struct image *img);
+
+/* Return the number of inodes in the image, including unused ones. */
+
+size_t image_files(const struct image *img);
+
+/* Return the number of names in the image. */
+
+size_t image_names(const struct image *img);
+
+/* Return a new file record for inode `ino`, as defined in the image,
+   and set its stamps `st`, or `NULL` if there is none, or its plugin
+   cannot be loaded, which is reported.  Terminates the program on
+   other failures. */
+
+struct file *image_file(const struct image *img, size_t ino,
+                        struct stamps *st);
+
+/* Find `name` in the image.  Returns 1 and stores its inode in `*ino`
+   if found, 0 otherwise. */
+
+int image_lookup(const struct image *img, const char *name, size_t *ino);
+
+/* Call `visit(name, ino, state)` for every name in the image, in the
+   order of sorting.  Stops if `visit` returns non-zero, and returns
+   that.  Otherwise, returns 0. */
+
+int image_traverse(const struct image *img, avl_VisitorFun visit,
+                   avl_State state);
+
+#endif
@@ -0,0 +1,758 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "fmap.h"
+#include "image.h"
+#include "libotffs.h"
+#include "overlay.h"
+#include "parser.h"
+#include "plugin.h"
+#include "prng.h"
+#include "probes.h"
+#include "profile.h"
+#include "record.h"
+#include "sequence.h"
+#include "stats.h"
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define mmap DO_NOT_USE
+#define munmap DO_NOT_USE
+
+/* See `libotffs.h` for documentation. */
+
+
+
+/* Return the size of `n` units of `unit` bytes, or of as many as fit
+   in a `ssize_t`. */
+
+static ssize_t units(size_t n, size_t unit) {
+    if (n > (size_t)SSIZE_MAX / unit)
+        n = (size_t)SSIZE_MAX / unit;
+    return (ssize_t)(n * unit);
+}
+
+/* Look up the source of `fp` below `rootFh`.  This is the slow part
+   of gathering, and does not modify `fp`.  Returns 0 on success, or
+   an error number. */
+
+static int probe(const struct file *fp, int rootFh, struct stat *buf) {
+
+    if (! fp->srcName)
+        return 0;
+
+    if (fstatat(rootFh, fp->srcName, buf, AT_SYMLINK_NOFOLLOW))
+        return errno;
+
+    if ((buf->st_mode & S_IFMT) != S_IFREG)
+        return EINVAL;
+
+    return 0;
+}
+
+/* Fill in the metadata of `fp` and its stamps `st`, using `buf` from
+   `probe`. */
+
+static void complete(struct file *fp, struct stamps *st,
+                     const struct stat *buf, time_t now) {
+
+    if (fp->srcName) {
+        if (fp->srcSize == uninitFile.srcSize) {
+            assert(buf->st_size >= 0);
+            fp->srcSize = (ssize_t)buf->st_size;
+        }
+
+        if (fp->size < 0)
+            fp->size = -(fp->size * fp->srcSize);
+
+        if (fp->mode == uninitFile.mode)
+            fp->mode = buf->st_mode;
+
+        if (st->mtime == uninitStamps.mtime)
+            st->mtime = buf->st_mtime;
+
+        if (st->atime == uninitStamps.atime)
+            st->atime = buf->st_atime;
+
+    } else {
+        if (fp->size < 0) {
+            switch (fp->srcSize) {
+            case algoRoot:
+                break;
+            case algoIntegers:
+            case algoChars:
+            case algoSequence:
+                fp->size = units((size_t)(-fp->size), sequence_period(fp));
+                break;
+            case algoXoshiro:
+            case algoMt19937:
+            case algoCompressible:
+                fp->size = units((size_t)(-fp->size), prng_block(fp));
+                break;
+            case algoCsv:
+            case algoJsonl: {
+                struct record r;
+                record_layout(fp, &r);
+                size_t n = min((size_t)(-fp->size),
+                               ((size_t)SSIZE_MAX - r.header) / r.stride);
+                fp->size = (ssize_t)(r.header + n * r.stride);
+                break;
+            }
+            case algoDedup: {
+                /* Of the pool of unique blocks, or of blocks if even
+                   one pool does not fit. */
+                size_t block = prng_block(fp), unique = prng_unique(fp);
+                if (block > (size_t)SSIZE_MAX / unique)
+                    fp->size = units(SIZE_MAX, block);
+                else
+                    fp->size = units((size_t)(-fp->size), block * unique);
+                break;
+            }
+            case algoPlugin:
+                fp->size = units((size_t)(-fp->size), plugin_size(fp->plugin));
+                break;
+            default:
+                assert(0);
+                break;
+            }
+        }
+
+        if (fp->mode == uninitFile.mode)
+            fp->mode = S_IFREG | 0600;
+
+        if (st->mtime == uninitStamps.mtime)
+            st->mtime = now;
+
+        if (st->atime == uninitStamps.atime)
+            st->atime = now;
+    }
+
+    if (fp->nlink == uninitFile.nlink)
+        fp->nlink = 1;
+
+    if (st->ctime == uninitStamps.ctime)
+        st->ctime = now;
+
+    __atomic_store_n(&fp->gathered, 1, __ATOMIC_RELEASE);
+}
+
+
+
+int otffs_gather(struct file *fp, struct stamps *st, int rootFh,
+                 time_t now) {
+    struct stat buf;
+    int e = probe(fp, rootFh, &buf);
+    if (! e)
+        complete(fp, st, &buf, now);
+    return e;
+}
+
+
+
+/* Serialises completing lazily gathered files.  Probing is done
+   outside, so slow sources do not hold up others. */
+
+static pthread_mutex_t readyLock = PTHREAD_MUTEX_INITIALIZER;
+
+int otffs_ready(struct fileSystem *fs, struct file *fp) {
+
+    if (__atomic_load_n(&fp->gathered, __ATOMIC_ACQUIRE))
+        return 0;
+
+    struct stat buf;
+    int e = probe(fp, fs->rootFh, &buf);
+    if (e)
+        return e;
+
+    ERRIF(pthread_mutex_lock(&readyLock));
+    if (! fp->gathered)
+        complete(fp, otffs_stamps(fs, fp), &buf, fs->now);
+    ERRIF(pthread_mutex_unlock(&readyLock));
+
+    return 0;
+}
+
+
+
+/* Report why gathering metadata of `fp` failed, and terminate. */
+
+static void gatherFailed(const struct file *fp, int e) {
+    if (e == EINVAL)
+        errx(1, "Refusing to use non-regular file `%s` as source.",
+             fp->srcName);
+    errno = e;
+    err(1, "Cannot stat `%s`", fp->srcName);
+}
+
+/* Used by `otffs_load` to gather all files in parallel.  Workers take
+   batches of inodes from a shared counter. */
+
+enum { GATHER_BATCH = 64 };
+
+struct gather_ctx {
+    struct fileSystem *fs;
+    size_t next; // first inode not yet taken by a worker
+};
+
+static void *gatherWorker(void *arg) {
+    struct gather_ctx *ctx = arg;
+    struct fileSystem *fs = ctx->fs;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&ctx->next, GATHER_BATCH,
+                                      __ATOMIC_RELAXED);
+        if (i >= fs->files.used)
+            break;
+
+        size_t end = min(i + GATHER_BATCH, fs->files.used);
+        for (; i < end; i++) {
+            struct file *fp = AT(fs->files, i);
+            if (! fp || fp->gathered)
+                continue;
+            int e = otffs_gather(fp, &AT(fs->stamps, i), fs->rootFh,
+                                 fs->now);
+            if (e)
+                gatherFailed(fp, e);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/* Return a new record for the root directory, and set its stamps in
+   `fs`. */
+
+static struct file *rootFile(struct fileSystem *fs, time_t now) {
+    struct file *fp = new(struct file);
+    *fp = uninitFile;
+    fp->size = 0;
+    fp->srcSize = algoRoot;
+    fp->mode = S_IFDIR | 0755;
+    fp->nlink = 2;
+    fp->gathered = 1;
+    fp->ino = ROOT_INO;
+    struct stamps *st = &AT(fs->stamps, ROOT_INO);
+    st->atime = st->mtime = st->ctime = now;
+    st->generation = 0;
+    return fp;
+}
+
+
+
+void otffs_load(struct fileSystem *fs, int rootFh, int configFh, time_t now,
+                unsigned int threads) {
+
+    fs->rootFh = rootFh;
+    fs->now = now;
+    fs->image = NULL;
+    fs->generation = 0;
+
+    /* AVL tree for looking up inode numbers by file name. */
+    fs->names = avl_new((avl_CmpFun)strcmp);
+    arena_init(&fs->strings);
+
+    /* Inode to file mapping: Arrays. */
+    ALLOCATE(fs->files, 8);
+    ALLOCATE(fs->stamps, 8);
+    ALLOCATE(fs->free, 8);
+
+    { // Add root directory to filesystem
+        arena_add(&fs->strings, '.');
+        char *name = arena_keep(&fs->strings);
+        ERRIF(avl_insert(fs->names, name, ROOT_INO, NULL));
+
+        for (size_t i = 0; i <= ROOT_INO; i++) {
+            PUSH(fs->files, NULL);
+            PUSH(fs->stamps, uninitStamps);
+        }
+        AT(fs->files, ROOT_INO) = rootFile(fs, now);
+    }
+
+    /* Add more files from user config. */
+    parse(fs, configFh);
+
+    /* For all files in the config, gather missing information from
+       the filesystem.  Or leave that to `otffs_ready`. */
+    if (! threads)
+        return;
+
+    struct gather_ctx ctx = { .fs = fs, .next = 0 };
+    pthread_t *tid = _new(threads * sizeof(*tid));
+    for (unsigned int t = 1; t < threads; t++)
+        ERRIF(pthread_create(&tid[t], NULL, gatherWorker, &ctx));
+    gatherWorker(&ctx);
+    for (unsigned int t = 1; t < threads; t++)
+        ERRIF(pthread_join(tid[t], NULL));
+    free(tid);
+}
+
+
+
+void otffs_compile(const struct fileSystem *fs, int imageFh) {
+    image_compile(fs, imageFh);
+}
+
+
+
+void otffs_map(struct fileSystem *fs, int rootFh, int imageFh, time_t now) {
+
+    fs->rootFh = rootFh;
+    fs->now = now;
+    fs->generation = 0;
+    fs->image = image_map(imageFh);
+    fs->names = NULL;
+    arena_init(&fs->strings);
+
+    /* Untouched pages of a large allocation are not really there, so
+       this is cheap even for many files. */
+    size_t n = max(image_files(fs->image), (size_t)ROOT_INO + 1);
+    fs->files.array = calloc(n, sizeof(*fs->files.array));
+    fs->stamps.array = calloc(n, sizeof(*fs->stamps.array));
+    ERRIF(! fs->files.array || ! fs->stamps.array);
+    fs->files.alloc = fs->files.used = n;
+    fs->stamps.alloc = fs->stamps.used = n;
+    ALLOCATE(fs->free, 8);
+
+    AT(fs->files, ROOT_INO) = rootFile(fs, now);
+}
+
+
+
+/* Free `fp` and everything it owns. */
+
+static void freeFile(struct file *fp) {
+    if (fp->overlay)
+        overlay_free(fp->overlay);
+    if (fp->profile)
+        profile_free(fp->profile);
+    if (fp->stats)
+        stats_free(fp->stats);
+    if (fp->plugin)
+        plugin_free(fp->plugin);
+    free(fp);
+}
+
+/* Serialises creating files from an image, so their stamps are set
+   before the file is published, and never overwritten after. */
+
+static pthread_mutex_t imageLock = PTHREAD_MUTEX_INITIALIZER;
+
+struct file *otffs_file(struct fileSystem *fs, size_t ino) {
+
+    if (ino >= fs->files.used)
+        return NULL;
+
+    struct file *fp = __atomic_load_n(&AT(fs->files, ino), __ATOMIC_ACQUIRE);
+    if (fp || ! fs->image)
+        return fp;
+
+    /* Materialise from the image.  Another thread may have been
+       faster. */
+    ERRIF(pthread_mutex_lock(&imageLock));
+    fp = AT(fs->files, ino);
+    if (! fp) {
+        struct stamps st;
+        fp = image_file(fs->image, ino, &st);
+        if (fp) {
+            AT(fs->stamps, ino) = st;
+            __atomic_store_n(&AT(fs->files, ino), fp, __ATOMIC_RELEASE);
+        }
+    }
+    ERRIF(pthread_mutex_unlock(&imageLock));
+    return fp;
+}
+
+struct stamps *otffs_stamps(struct fileSystem *fs, const struct file *fp) {
+    return &AT(fs->stamps, fp->ino);
+}
+
+
+
+struct file *otffs_peek(struct fileSystem *fs, size_t ino) {
+    if (ino >= fs->files.used)
+        return NULL;
+    return __atomic_load_n(&AT(fs->files, ino), __ATOMIC_ACQUIRE);
+}
+
+
+
+/* Whether `fp` was unlinked, see `otffs_unlink`. */
+
+static int unlinked(const struct file *fp) {
+    return fp && fp->gathered && ! fp->nlink;
+}
+
+int otffs_lookup(struct fileSystem *fs, const char *name, size_t *ino) {
+    if (! fs->image)
+        return avl_lookup(fs->names, name, ino);
+    return image_lookup(fs->image, name, ino)
+        && ! unlinked(__atomic_load_n(&AT(fs->files, *ino), __ATOMIC_ACQUIRE));
+}
+
+static int delFun(char *name, size_t ino, size_t *found) {
+    (void)name; // lives in the arena
+    *found = ino;
+    return 0;
+}
+
+int otffs_unlink(struct fileSystem *fs, const char *name, size_t *ino) {
+
+    if (fs->image ? ! otffs_lookup(fs, name, ino)
+        : ! avl_deleteWith((avl_VisitorFun)delFun, fs->names, name, ino))
+        return 0;
+
+    /* Only open files can still see it, and these were gathered on
+       lookup already. */
+    struct file *fp = otffs_file(fs, *ino);
+    fp->nlink = 0;
+    fp->gathered = 1;
+    ENOUGH(fs->free);
+    PUSH(fs->free, *ino);
+    return 1;
+}
+
+/* Used by `otffs_traverse` to skip unlinked files of an image. */
+
+struct traverse_ctx {
+    struct fileSystem *fs;
+    avl_VisitorFun visit;
+    avl_State state;
+};
+
+static int traverseFun(const char *name, size_t ino, struct traverse_ctx *ctx) {
+    if (unlinked(__atomic_load_n(&AT(ctx->fs->files, ino), __ATOMIC_ACQUIRE)))
+        return 0;
+    return ctx->visit(name, ino, ctx->state);
+}
+
+int otffs_traverse(struct fileSystem *fs, avl_VisitorFun visit,
+                   avl_State state) {
+    if (! fs->image)
+        return avl_traverse(fs->names, visit, state);
+    struct traverse_ctx ctx = { .fs = fs, .visit = visit, .state = state };
+    return image_traverse(fs->image, (avl_VisitorFun)traverseFun, &ctx);
+}
+
+size_t otffs_count(const struct fileSystem *fs) {
+    return fs->image ? image_names(fs->image) : avl_size(fs->names);
+}
+
+
+
+/* Used by `otffs_adopt` to renumber files.  Files defined as before
+   take their old inode number, and are marked in `kept`.  The others
+   are collected in `fresh`, to be numbered later. */
+
+struct adopt_ctx {
+    const struct fileSystem *fs, *old;
+    STACK(struct file *) files;
+    STACK(struct stamps) stamps; // of `files`
+    avl_Tree names;
+    char *kept; // by old inode number
+    STACK(char *) fresh; // names of files to number
+};
+
+static int adoptFun(char *name, size_t ino, struct adopt_ctx *ctx) {
+
+    struct file *fp = AT(ctx->fs->files, ino);
+    struct stamps st = AT(ctx->fs->stamps, ino);
+    struct file *op = NULL;
+    size_t oldIno;
+
+    if (ino != ROOT_INO && avl_lookup(ctx->old->names, name, &oldIno))
+        op = AT(ctx->old->files, oldIno);
+
+    if (ino == ROOT_INO) {
+        oldIno = ROOT_INO;
+        st.generation = 0;
+    } else if (op && op->def == fp->def) {
+        const struct stamps *os = &AT(ctx->old->stamps, oldIno);
+        if (op->gathered) {
+            fp->size = op->size;
+            fp->mode = op->mode;
+            fp->nlink = op->nlink;
+            st.atime = os->atime;
+            st.mtime = os->mtime;
+            st.ctime = os->ctime;
+            fp->srcSize = op->srcSize;
+            fp->gathered = 1;
+        }
+        if (op->overlay) {
+            if (fp->overlay)
+                overlay_free(fp->overlay);
+            fp->overlay = overlay_share(op->overlay);
+        }
+        if (op->stats)
+            fp->stats = stats_share(op->stats);
+        st.generation = os->generation;
+    } else {
+        ENOUGH(ctx->fresh);
+        PUSH(ctx->fresh, name);
+        return 0;
+    }
+
+    ctx->kept[oldIno] = 1;
+    fp->ino = oldIno;
+    AT(ctx->files, oldIno) = fp;
+    AT(ctx->stamps, oldIno) = st;
+    ERRIF(avl_insert(ctx->names, name, oldIno, NULL));
+    return 0;
+}
+
+/* Used by `otffs_adopt` to find names that no longer refer to the same
+   file. */
+
+struct stale_ctx {
+    avl_Tree names;
+    const char *kept;
+    void (*stale)(const char *name, size_t ino, void *arg);
+    void *arg;
+};
+
+static int staleFun(char *name, size_t ino, struct stale_ctx *ctx) {
+    size_t now;
+    if (! (avl_lookup(ctx->names, name, &now) && now == ino && ctx->kept[ino]))
+        ctx->stale(name, ino, ctx->arg);
+    return 0;
+}
+
+/* Used by `otffs_adopt` to free the inode numbers of old files not
+   kept. */
+
+struct free_ctx {
+    const char *kept;
+    struct fileSystem *fs;
+};
+
+static int freeFun(char *name, size_t ino, struct free_ctx *ctx) {
+    (void)name;
+    if (! ctx->kept[ino]) {
+        ENOUGH(ctx->fs->free);
+        PUSH(ctx->fs->free, ino);
+    }
+    return 0;
+}
+
+
+
+void otffs_adopt(struct fileSystem *fs, const struct fileSystem *old,
+                 void (*stale)(const char *name, size_t ino, void *arg),
+                 int (*busy)(size_t ino, void *arg), void *arg) {
+
+    struct adopt_ctx ctx = {
+        .fs = fs,
+        .old = old,
+        .names = avl_new((avl_CmpFun)strcmp),
+        .kept = calloc(old->files.used, 1),
+    };
+    ERRIF(! ctx.names || ! ctx.kept);
+    ALLOCATE(ctx.fresh, 64);
+
+    /* Enough room for all old inode numbers and all new files. */
+    ALLOCATE(ctx.files, old->files.used + fs->files.used);
+    ALLOCATE(ctx.stamps, ctx.files.alloc);
+    while (ctx.files.used < ctx.files.alloc) {
+        PUSH(ctx.files, NULL);
+        PUSH(ctx.stamps, uninitStamps);
+    }
+
+    avl_traverse(fs->names, (avl_VisitorFun)adoptFun, &ctx);
+
+    /* The free-list: Inode numbers freed by `otffs_unlink`, and those
+       of files not kept. */
+    for (size_t i = 0; i < old->free.used; i++) {
+        ENOUGH(fs->free);
+        PUSH(fs->free, AT(old->free, i));
+    }
+    struct free_ctx fctx = { .kept = ctx.kept, .fs = fs };
+    avl_traverse(old->names, (avl_VisitorFun)freeFun, &fctx);
+
+    /* Number the other files from the free-list first.  A number must
+       not be in use by the caller anymore, or it stays on the list for
+       the next time.  Its new file gets a generation number no file
+       had before, so the pair of inode and generation is unique. */
+    STACK(size_t) held;
+    ALLOCATE(held, 8);
+    fs->generation = old->generation + 1;
+    size_t next = old->files.used;
+    for (size_t i = 0; i < ctx.fresh.used; i++) {
+        size_t ino = next;
+        while (fs->free.used) {
+            size_t f = POP(fs->free);
+            if (! (busy && busy(f, arg))) {
+                ino = f;
+                break;
+            }
+            ENOUGH(held);
+            PUSH(held, f);
+        }
+        if (ino == next)
+            next++;
+        size_t newIno;
+        ERRIF(! avl_lookup(fs->names, AT(ctx.fresh, i), &newIno));
+        struct file *fp = AT(fs->files, newIno);
+        struct stamps *st = &AT(ctx.stamps, ino);
+        *st = AT(fs->stamps, newIno);
+        st->generation = fs->generation;
+        fp->ino = ino;
+        AT(ctx.files, ino) = fp;
+        ERRIF(avl_insert(ctx.names, AT(ctx.fresh, i), ino, NULL));
+    }
+    while (held.used) {
+        ENOUGH(fs->free);
+        PUSH(fs->free, POP(held));
+    }
+    free(held.array);
+    ctx.files.used = ctx.stamps.used = next;
+
+    struct stale_ctx sctx = {
+        .names = ctx.names,
+        .kept = ctx.kept,
+        .stale = stale,
+        .arg = arg,
+    };
+    avl_traverse(old->names, (avl_VisitorFun)staleFun, &sctx);
+
+    free(ctx.kept);
+    free(ctx.fresh.array);
+    free(fs->files.array);
+    free(fs->stamps.array);
+    avl_free(fs->names, NULL, NULL);
+    fs->names = ctx.names;
+    fs->files.alloc = ctx.files.alloc;
+    fs->files.used = ctx.files.used;
+    fs->files.array = ctx.files.array;
+    fs->stamps.alloc = ctx.stamps.alloc;
+    fs->stamps.used = ctx.stamps.used;
+    fs->stamps.array = ctx.stamps.array;
+}
+
+
+
+void otffs_free(struct fileSystem *fs) {
+
+    for (size_t i = 0; i < fs->files.used; i++)
+        if (AT(fs->files, i))
+            freeFile(AT(fs->files, i));
+
+    free(fs->files.array);
+    free(fs->stamps.array);
+    free(fs->free.array);
+    if (fs->names)
+        avl_free(fs->names, NULL, NULL);
+    if (fs->image)
+        image_free(fs->image);
+    arena_free(&fs->strings);
+}
+
+
+
+/* Used by `otffs_fill` to implement `pass <realfile>`: The content is
+   a repetition of the source file. */
+
+static void fillFile(const struct file *fp, int fh, size_t off, size_t len,
+                     char *buf) {
+    PROBE4(source, fp->ino, off, len, len);
+    const size_t b = (size_t)fp->srcSize; // "block": all src file content
+    size_t s = off % b; // where in the first "block" to start reading
+
+    if (s + len <= b) { // only one block: map only req'd region
+        struct mapping m;
+        fmap_map(&m, fh, s, len);
+        memcpy(buf, m.buf, len);
+        fmap_unmap(&m);
+        return;
+    }
+
+    /* Map the whole file into memory, and copy the blocks. */
+    struct mapping m;
+    fmap_map(&m, fh, 0, b);
+    for (size_t done = 0, n; done < len; done += n, s = 0) {
+        n = min(b - s, len - done);
+        memcpy(buf + done, m.buf + s, n);
+    }
+    fmap_unmap(&m);
+}
+
+
+
+/* State of a reader, see `otffs_cursor`.  Readers using the same
+   cursor concurrently do not wait for each other, only one of them
+   uses the cursor. */
+
+struct otffs_cursor {
+    pthread_mutex_t lock;
+    struct prng prng;
+};
+
+struct otffs_cursor *otffs_cursor(const struct file *fp) {
+    if (fp->srcName || (fp->srcSize != algoXoshiro &&
+                        fp->srcSize != algoMt19937))
+        return NULL;
+    struct otffs_cursor *c = new(struct otffs_cursor);
+    ERRIF(pthread_mutex_init(&c->lock, NULL));
+    prng_init(&c->prng);
+    return c;
+}
+
+void otffs_cursorFree(struct otffs_cursor *c) {
+    if (! c)
+        return;
+    ERRIF(pthread_mutex_destroy(&c->lock));
+    free(c);
+}
+
+/* Used by `otffs_fillFrom` for the pseudo-random algorithms. */
+
+static void fillPrng(const struct file *fp, struct otffs_cursor *c,
+                     size_t off, size_t len, char *buf) {
+    if (c && ! pthread_mutex_trylock(&c->lock)) {
+        prng_fill(fp, &c->prng, off, len, buf);
+        ERRIF(pthread_mutex_unlock(&c->lock));
+    } else {
+        struct prng p;
+        prng_init(&p);
+        prng_fill(fp, &p, off, len, buf);
+    }
+}
+
+
+
+void otffs_fillFrom(const struct file *fp, int fh, struct otffs_cursor *c,
+                    size_t off, size_t len, char *buf) {
+
+    if (!len)
+        return;
+
+    PROBE3(fill_entry, fp->ino, off, len);
+    if (fp->srcName)
+        fillFile(fp, fh, off, len, buf);
+    else if (fp->srcSize == algoIntegers || fp->srcSize == algoChars
+             || fp->srcSize == algoSequence)
+        sequence_fill(fp, off, len, buf);
+    else if (fp->srcSize == algoXoshiro || fp->srcSize == algoMt19937)
+        fillPrng(fp, c, off, len, buf);
+    else if (fp->srcSize == algoCompressible)
+        prng_compressible(fp, off, len, buf);
+    else if (fp->srcSize == algoDedup)
+        prng_dedup(fp, off, len, buf);
+    else if (fp->srcSize == algoCsv || fp->srcSize == algoJsonl)
+        record_fill(fp, off, len, buf);
+    else if (fp->srcSize == algoPlugin)
+        plugin_fill(fp, off, len, buf);
+    else
+        assert(0);
+    PROBE4(fill_return, fp->ino, off, len, len);
+}
+
+void otffs_fill(const struct file *fp, int fh, size_t off, size_t len,
+                char *buf) {
+    otffs_fillFrom(fp, fh, NULL, off, len, buf);
+}
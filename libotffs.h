@@ -0,0 +1,133 @@
+/* The content generation library: Everything needed to know what an
+   otffs file contains, without mounting anything.  Used by the FUSE
+   server `otffs`, and by the tools verifying or reproducing its
+   files. */
+
+#ifndef libotffs_Wq3tNcJ8vLpd
+#define libotffs_Wq3tNcJ8vLpd
+
+#include "common.h"
+#include <time.h>
+
+/* Set up `fs` from the config file opened as `configFh`, and close
+   that: Callers must not close `configFh` again.  Sources of `pass`
+   files are looked up relative to the directory `rootFh`, which must
+   stay open.  The root directory is added as inode `ROOT_INO`.
+
+   With `threads > 0`, all metadata not given in the config is gathered
+   as by `otffs_gather`, by that many threads in parallel, with `now`
+   as the default time stamp.  With `threads == 0`, nothing is gathered
+   in advance, so use `otffs_ready` before looking at metadata.
+   Terminates the program on errors. */
+
+#define ROOT_INO 1
+
+void otffs_load(struct fileSystem *fs, int rootFh, int configFh, time_t now,
+                unsigned int threads);
+
+/* Write the files of `fs`, as loaded by `otffs_load` with `threads ==
+   0`, to `imageFh` as an image.  See `image.h`. */
+
+void otffs_compile(const struct fileSystem *fs, int imageFh);
+
+/* Set up `fs` from the image `imageFh`, as `otffs_load` does with
+   `threads == 0`.  This takes constant time: Files are created from
+   the image on first use by `otffs_file`. */
+
+void otffs_map(struct fileSystem *fs, int rootFh, int imageFh, time_t now);
+
+/* Return the file with inode `ino` in `fs`, or `NULL`.  May be called
+   concurrently. */
+
+struct file *otffs_file(struct fileSystem *fs, size_t ino);
+
+/* Return the file with inode `ino` in `fs` if it has been set up, or
+   `NULL`.  Unlike `otffs_file`, never creates files from an image. */
+
+struct file *otffs_peek(struct fileSystem *fs, size_t ino);
+
+/* Return the stamps of `fp`, a file of `fs`.  Like the rest of the
+   metadata, they are complete once `otffs_ready` returned 0. */
+
+struct stamps *otffs_stamps(struct fileSystem *fs, const struct file *fp);
+
+/* Find `name` in `fs`.  Returns 1 and stores its inode in `*ino` if
+   found, 0 otherwise. */
+
+int otffs_lookup(struct fileSystem *fs, const char *name, size_t *ino);
+
+/* Remove `name` from `fs`.  Its file stays, with a link count of 0.
+   Returns 1 and stores its inode in `*ino` if found, 0 otherwise. */
+
+int otffs_unlink(struct fileSystem *fs, const char *name, size_t *ino);
+
+/* Call `visit(name, ino, state)` for every name in `fs`, sorted.  See
+   `avl_traverse`. */
+
+int otffs_traverse(struct fileSystem *fs, avl_VisitorFun visit,
+                   avl_State state);
+
+/* Return the number of names in `fs`, including the root directory. */
+
+size_t otffs_count(const struct fileSystem *fs);
+
+/* Fill in all metadata of `fp` and its stamps `st` that was not
+   specified in the config file, either from its source below
+   `rootFh`, or from the specifics of the generating algorithm.
+   Returns 0 on success, or an error number: `EINVAL` if the source is
+   not a regular file, otherwise as from stat(2). */
+
+int otffs_gather(struct file *fp, struct stamps *st, int rootFh,
+                 time_t now);
+
+/* Make sure the metadata of `fp` in `fs` is complete, gathering it on
+   first use.  May be called concurrently.  Returns as `otffs_gather`,
+   a failed attempt is repeated on the next call. */
+
+int otffs_ready(struct fileSystem *fs, struct file *fp);
+
+/* Renumber the files of `fs`, freshly loaded from a config, to match
+   `old`, the previous version of the same file system.  Files defined
+   exactly as before keep their inode and generation numbers, and take
+   over the metadata and written data of their old version.  All other
+   files reuse inode numbers of `old` no longer needed, unless
+   `busy(ino, arg)` says otherwise, and only then get new numbers.
+   They get a generation number larger than any before.  `busy` may be
+   `NULL`.  For every name in `old` that is gone or refers to another
+   file now, `stale(name, ino, arg)` is called. */
+
+void otffs_adopt(struct fileSystem *fs, const struct fileSystem *old,
+                 void (*stale)(const char *name, size_t ino, void *arg),
+                 int (*busy)(size_t ino, void *arg), void *arg);
+
+/* Free `fs` and all its files. */
+
+void otffs_free(struct fileSystem *fs);
+
+/* Store the `len` bytes of the content of `fp` starting at offset
+   `off` in `buf`.  For `pass` files, `fh` is an open handle of the
+   source, it is ignored otherwise.  The caller must make sure not to
+   read beyond the size of the file. */
+
+void otffs_fill(const struct file *fp, int fh, size_t off, size_t len,
+                char *buf);
+
+/* Return a new cursor for reading `fp`, or `NULL` if reading `fp` does
+   not benefit from one.  A cursor remembers where the previous read
+   stopped, so a sequential reader continues from there instead of
+   starting over from the last point it can seek to.  Terminates the
+   program on failure. */
+
+struct otffs_cursor *otffs_cursor(const struct file *fp);
+
+/* Free cursor `c`, which may be `NULL`. */
+
+void otffs_cursorFree(struct otffs_cursor *c);
+
+/* As `otffs_fill`, continuing from cursor `c` if possible.  `c` may be
+   `NULL`, and may be used concurrently. */
+
+void otffs_fillFrom(const struct file *fp, int fh, struct otffs_cursor *c,
+                    size_t off, size_t len, char *buf);
+
+#endif
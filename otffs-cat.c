@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Write (a range of) the content of an otffs file to stdout, without
+   mounting anything:
+
+       otffs-cat <config> <file> [off len]
+
+   Sources of `pass` files are looked up relative to the directory of
+   the config file.
+
+   If stdout is a pipe, the data is handed over with vmsplice(2).  The
+   pipe then refers to the pages of the buffer until the data is
+   consumed, which may be much later if the reader splices it onward,
+   e.g., to another pipe.  So a buffer is never refilled once spliced:
+   Each chunk gets a fresh mapping, unmapped right after splicing, and
+   its pages live on as long as the pipes refer to them. */
+
+enum { PIPE_SIZE = 1 << 20 };
+
+static const char *usage = "usage: otffs-cat <config> <file> [off len]";
+
+
+
+/* Write all of `buf` to `fd`, using vmsplice(2) if `*splice` is set.
+   Clears `*splice` if `fd` turns out not to be a pipe. */
+
+static void output(int fd, const char *buf, size_t len, int *splice) {
+
+    while (len) {
+        ssize_t r;
+        if (*splice) {
+            struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+            r = vmsplice(fd, &iov, 1, 0);
+            if (r < 0 && (errno == EBADF || errno == EINVAL)) {
+                *splice = 0;
+                continue;
+            }
+        } else {
+            r = write(fd, buf, len);
+        }
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            err(1, "Writing output");
+        }
+        buf += r;
+        len -= (size_t)r;
+    }
+}
+
+
+
+int main(int argc, char **argv) {
+
+    if (argc != 3 && argc != 5)
+        errx(1, "%s", usage);
+
+    struct fileSystem fs;
+    struct file *fp;
+    int srcFh = -1;
+
+    { /* Load the config, sources are relative to it. */
+        char *dir = strdup(argv[1]);
+        ERRIF(! dir);
+        int rootFh = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+        if (rootFh < 0)
+            err(1, "Failed to open directory of %s", argv[1]);
+        free(dir);
+
+        int fh = open(argv[1], O_RDONLY);
+        if (fh < 0)
+            err(1, "Failed to open config file: %s", argv[1]);
+
+        otffs_load(&fs, rootFh, fh, time(NULL), 0); // closes `fh`
+
+        size_t ino;
+        if (! avl_lookup(fs.names, argv[2], &ino))
+            errx(1, "No definition of `%s` in %s", argv[2], argv[1]);
+        fp = AT(fs.files, ino);
+
+        int e = otffs_ready(&fs, fp);
+        if (e) {
+            errno = e;
+            err(1, "Cannot gather metadata of `%s`", argv[2]);
+        }
+
+        if (! S_ISREG(fp->mode))
+            errx(1, "Not a regular file: %s", argv[2]);
+
+        if (fp->srcName) {
+            srcFh = openat(rootFh, fp->srcName, O_RDONLY);
+            if (srcFh < 0)
+                err(1, "Failed to open source `%s`", fp->srcName);
+        }
+        close(rootFh);
+    }
+
+    size_t off = 0, len = (size_t)fp->size;
+    if (argc == 5) {
+        char *e1, *e2;
+        off = strtoul(argv[3], &e1, 10);
+        len = strtoul(argv[4], &e2, 10);
+        if (*e1 || *e2)
+            errx(1, "%s", usage);
+    }
+    if (off >= (size_t)fp->size)
+        len = 0;
+    else
+        len = min(len, (size_t)fp->size - off);
+
+    /* Use vmsplice(2) only if stdout is a pipe. */
+    int splice = 1;
+    size_t chunk = PIPE_SIZE;
+    int ps = fcntl(1, F_SETPIPE_SZ, PIPE_SIZE);
+    if (ps < 0)
+        ps = fcntl(1, F_GETPIPE_SZ);
+    if (ps > 0)
+        chunk = (size_t)ps;
+    else
+        splice = 0;
+
+    char *buf = NULL; // reused only if not spliced
+    for (size_t done = 0; done < len; ) {
+        size_t n = min(chunk, len - done);
+        if (! buf) {
+            buf = mmap(NULL, chunk, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            ERRIF(buf == MAP_FAILED);
+        }
+        otffs_fill(fp, srcFh, off + done, n, buf);
+        output(1, buf, n, &splice);
+        if (splice) {
+            ERRIF(munmap(buf, chunk));
+            buf = NULL;
+        }
+        done += n;
+    }
+
+    if (buf)
+        ERRIF(munmap(buf, chunk));
+    if (srcFh >= 0)
+        close(srcFh);
+
+    return 0;
+}
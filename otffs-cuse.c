@@ -0,0 +1,255 @@
+#define FUSE_USE_VERSION 31
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include <cuse_lowlevel.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Expose an otffs file as a character device, using CUSE, like a
+   reproducible /dev/urandom:
+
+       otffs-cuse [-n name] [-p] [-t bytes]... <config> <file> [FUSE options]
+
+   E.g., as root
+
+       # ./otffs-cuse -n otffs-random0 otffsrc random
+       # dd if=/dev/otffs-random0 bs=1M count=4096 of=/dev/null
+
+   Reading the device yields the content of `file`, repeated endlessly.
+   Every open starts at the beginning with its own position and
+   producer state, so each reader gets the same stream, whatever other
+   readers do.  With `-p`, every open gets a stream of its own instead:
+   The n-th open, counting from 0, reads the file as if its seed were n
+   larger.  There is no file size, offset, or page cache involved: The
+   device cannot seek, and every read(2) goes to `cuse_read`.  Writing
+   is refused.
+
+   The device is named `otffs-<file>` unless `-n` says otherwise.  The
+   FUSE options are those of cuse_lowlevel_main, e.g., `-f` to stay in
+   the foreground and `-s` for a single thread.
+
+   With `-t`, nothing is served: Each `-t` opens the stream once, and
+   writes the first `bytes` read from it to stdout, e.g., to check the
+   streams without CUSE. */
+
+enum { TEST_READ = 64 << 10 }; // bytes per read with `-t`
+
+static const char *usage =
+    "usage: otffs-cuse [-n name] [-p] [-t bytes]... <config> <file>"
+    " [FUSE options]";
+
+static struct file *fp; // exposed as the device
+static int srcFh = -1; // source of `pass` files, else -1
+static int perOpen; // seeds, see `-p`
+static uint64_t opens; // so far, numbering them for `perOpen`
+
+/* State of an open of the device, in `fi->fh`.  Readers sharing a
+   descriptor take turns. */
+
+struct stream {
+    pthread_mutex_t lock;
+    struct file file; // `*fp`, with the seed of this open
+    size_t pos; // in the file, of the next byte
+    struct otffs_cursor *cursor;
+    char *buf;
+    size_t alloc; // of `buf`
+};
+
+
+
+/* A stream at the start of the file, with a seed of its own if
+   `perOpen`. */
+
+static struct stream *streamOpen(void) {
+    struct stream *s = new(struct stream);
+    *s = (struct stream){ .file = *fp };
+    if (perOpen)
+        s->file.param.seed += __atomic_fetch_add(&opens, 1, __ATOMIC_RELAXED);
+    s->cursor = otffs_cursor(&s->file);
+    ERRIF(pthread_mutex_init(&s->lock, NULL));
+    return s;
+}
+
+/* Read the next `size` bytes of `s` into `s->buf`, under `s->lock`.
+   Files of size 0 yield nothing. */
+
+static size_t streamRead(struct stream *s, size_t size) {
+
+    const size_t fileSize = (size_t)s->file.size;
+    if (! fileSize)
+        return 0;
+
+    if (s->alloc < size) {
+        free(s->buf);
+        s->buf = malloc(size);
+        ERRIF(! s->buf);
+        s->alloc = size;
+    }
+    for (size_t done = 0; done < size; ) {
+        size_t n = min(size - done, fileSize - s->pos);
+        otffs_fillFrom(&s->file, srcFh, s->cursor, s->pos, n, s->buf + done);
+        done += n;
+        s->pos += n;
+        if (s->pos == fileSize)
+            s->pos = 0;
+    }
+    return size;
+}
+
+static void streamFree(struct stream *s) {
+    ERRIF(pthread_mutex_destroy(&s->lock));
+    otffs_cursorFree(s->cursor);
+    free(s->buf);
+    free(s);
+}
+
+
+
+static void cuse_open(fuse_req_t req, struct fuse_file_info *fi) {
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    struct stream *s = streamOpen();
+    fi->fh = (uintptr_t)s;
+    fi->direct_io = 1;
+    fi->nonseekable = 1;
+    if (fuse_reply_open(req, fi))
+        err(1, "Fatal fuse_reply_open at " __FILE__ ":%d", __LINE__);
+}
+
+/* The kernel passes no offset to character devices, `s->pos` is the
+   position. */
+
+static void cuse_read(fuse_req_t req, size_t size, off_t off,
+                      struct fuse_file_info *fi) {
+
+    (void)off;
+    struct stream *s = (struct stream *)fi->fh;
+    ERRIF(pthread_mutex_lock(&s->lock));
+    size = streamRead(s, size);
+    int e = fuse_reply_buf(req, s->buf, size);
+    ERRIF(pthread_mutex_unlock(&s->lock));
+    if (e)
+        err(1, "Fatal fuse_reply_buf at " __FILE__ ":%d", __LINE__);
+}
+
+static void cuse_release(fuse_req_t req, struct fuse_file_info *fi) {
+    streamFree((struct stream *)fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+
+
+int main(int argc, char **argv) {
+
+    const char *name = NULL;
+    struct fileSystem fs;
+    size_t tests[argc], nTests = 0; // bytes, of `-t`
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:pt:")) != -1) {
+        char *e;
+        switch (opt) {
+        case 'n': name = optarg; break;
+        case 'p': perOpen = 1; break;
+        case 't':
+            tests[nTests++] = strtoul(optarg, &e, 10);
+            if (! *optarg || *e)
+                errx(1, "%s", usage);
+            break;
+        default: errx(1, "%s", usage);
+        }
+    }
+    if (argc - optind < 2)
+        errx(1, "%s", usage);
+    const char *config = argv[optind], *file = argv[optind + 1];
+
+    { /* Load the config, sources are relative to it. */
+        char *dir = strdup(config);
+        ERRIF(! dir);
+        int rootFh = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+        if (rootFh < 0)
+            err(1, "Failed to open directory of %s", config);
+        free(dir);
+
+        int fh = open(config, O_RDONLY);
+        if (fh < 0)
+            err(1, "Failed to open config file: %s", config);
+
+        otffs_load(&fs, rootFh, fh, time(NULL), 0); // closes `fh`
+
+        size_t ino;
+        if (! otffs_lookup(&fs, file, &ino) || ! (fp = otffs_file(&fs, ino)))
+            errx(1, "No definition of `%s` in %s", file, config);
+
+        int e = otffs_ready(&fs, fp);
+        if (e) {
+            errno = e;
+            err(1, "Cannot gather metadata of `%s`", file);
+        }
+
+        if (! S_ISREG(fp->mode))
+            errx(1, "Not a regular file: %s", file);
+
+        if (fp->srcName) {
+            srcFh = openat(rootFh, fp->srcName, O_RDONLY);
+            if (srcFh < 0)
+                err(1, "Failed to open source `%s`", fp->srcName);
+        }
+        close(rootFh);
+    }
+
+    for (size_t i = 0; i < nTests; i++) {
+        struct stream *s = streamOpen();
+        for (size_t left = tests[i], n; left; left -= n) {
+            n = streamRead(s, min(left, (size_t)TEST_READ));
+            if (! n)
+                break;
+            for (size_t done = 0; done < n; ) {
+                ssize_t w = write(1, s->buf + done, n - done);
+                if (w < 0)
+                    err(1, "Failed to write to stdout");
+                done += (size_t)w;
+            }
+        }
+        streamFree(s);
+    }
+    if (nTests)
+        return 0;
+
+    char *base = strdup(file), devName[256];
+    ERRIF(! base);
+    if (name)
+        snprintf(devName, sizeof(devName), "DEVNAME=%s", name);
+    else
+        snprintf(devName, sizeof(devName), "DEVNAME=otffs-%s",
+                 basename(base));
+    free(base);
+
+    const char *devInfo[] = { devName };
+    const struct cuse_info ci = {
+        .dev_info_argc = 1,
+        .dev_info_argv = devInfo,
+    };
+    const struct cuse_lowlevel_ops ops = {
+        .open = cuse_open,
+        .read = cuse_read,
+        .release = cuse_release,
+    };
+
+    /* The FUSE options follow the file. */
+    argv[optind + 1] = argv[0];
+    return cuse_lowlevel_main(argc - optind - 1, argv + optind + 1, &ci,
+                              &ops, NULL);
+}
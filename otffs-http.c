@@ -0,0 +1,606 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Serve the files of an otffs config over HTTP/1.1, without mounting
+   anything, as a reference origin for testing clients and proxies:
+
+       otffs-http [-l host:port | -u socket] [-j threads] <config>
+
+   Every file is at `/name`, percent-encoded.  GET and HEAD are
+   supported, with a single byte range, and keep-alive.  Requests
+   pipelined on a connection are answered in order.  Multiple ranges
+   are ignored, so the whole file is sent, as HTTP allows.  Like for
+   `otffs-cat`, sources of `pass` files are looked up relative to the
+   directory of the config.  The config is read once.
+
+   Each thread runs an event loop with epoll(7) over the connections it
+   accepted, there is no thread per connection.  The body is produced
+   in chunks into a buffer of the connection, and sent together with
+   the remaining header by writev(2).  A connection sends at most
+   `BUDGET` chunks before others get their turn. */
+
+enum {
+    REQUEST_MAX = 8192, // bytes of request line and headers
+    HEAD_MAX = 1024, // bytes of response header
+    CHUNK = 1 << 18, // bytes of body produced at once
+    BUDGET = 16, // chunks sent per turn
+    EVENTS = 64,
+    MAX_THREADS = 256,
+};
+
+static const char *usage =
+    "usage: otffs-http [-l host:port | -u socket] [-j threads] <config>";
+
+
+
+/* A client connection, and the response it is sent. */
+
+struct conn {
+    int fd;
+    unsigned int events; // registered with epoll
+    int eof; // the client sends no more requests
+    char in[REQUEST_MAX]; // received, not yet answered
+    size_t inLen;
+
+    int busy; // sending a response
+    int keep; // alive after the response
+    int http10; // the request is HTTP/1.0, so keep-alive is announced
+    char head[HEAD_MAX];
+    size_t headLen, headOff; // unsent: [headOff, headLen)
+    struct file *fp; // of the body, NULL: none
+    int srcFh; // source of `pass` files, else -1
+    struct otffs_cursor *cursor;
+    size_t off, end; // body not produced yet
+    char *buf; // CHUNK bytes, NULL until the first body
+    size_t bufLen, bufOff; // unsent: [bufOff, bufLen)
+};
+
+static struct fileSystem fs;
+static int rootFh; // directory of the config
+static int listenFh;
+
+
+
+/* Format `t` as an HTTP date into `s`, of at least 32 bytes. */
+
+static void httpDate(char *s, time_t t) {
+    struct tm tm;
+    ERRIF(! gmtime_r(&t, &tm));
+    strftime(s, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* Start the header of the response of `c` with the status line, and
+   the headers all responses have.  Returns its length. */
+
+static size_t status(struct conn *c, const char *st) {
+    char date[32];
+    httpDate(date, time(NULL));
+    const char *conn = ! c->keep ? "Connection: close\r\n"
+        : c->http10 ? "Connection: keep-alive\r\n" : "";
+    int n = snprintf(c->head, HEAD_MAX, "HTTP/1.1 %s\r\nDate: %s\r\n%s",
+                     st, date, conn);
+    ERRIF(n < 0 || n >= HEAD_MAX);
+    return (size_t)n;
+}
+
+/* Respond to `c` with `st`, without a body. */
+
+static void fail(struct conn *c, const char *st, const char *extra) {
+    size_t n = status(c, st);
+    int m = snprintf(c->head + n, HEAD_MAX - n,
+                     "%sContent-Length: 0\r\n\r\n", extra);
+    ERRIF(m < 0 || (size_t)m >= HEAD_MAX - n);
+    c->headLen = n + (size_t)m;
+    c->headOff = 0;
+    c->fp = NULL;
+    c->off = c->end = 0;
+    c->bufLen = c->bufOff = 0;
+    c->busy = 1;
+}
+
+/* Parse the `Range` header value `v` for a file of `size` bytes into
+   [*from, *to).  Returns 1 for a range, 0 if the header is to be
+   ignored, -1 if the range is not satisfiable. */
+
+static int range(const char *v, size_t size, size_t *from, size_t *to) {
+
+    if (strncasecmp(v, "bytes=", 6) || strchr(v, ','))
+        return 0;
+    v += 6;
+
+    char *e;
+    unsigned long long a, b;
+    if (*v == '-') { // the last bytes
+        errno = 0;
+        b = strtoull(v + 1, &e, 10);
+        if (e == v + 1 || *e || errno)
+            return 0;
+        if (! b || ! size)
+            return -1;
+        *from = size - (size_t)min(b, (unsigned long long)size);
+        *to = size;
+        return 1;
+    }
+
+    errno = 0;
+    a = strtoull(v, &e, 10);
+    if (e == v || *e != '-' || errno)
+        return 0;
+    v = e + 1;
+    b = ULLONG_MAX;
+    if (*v) {
+        b = strtoull(v, &e, 10);
+        if (*e || errno || b < a)
+            return 0;
+    }
+    if (a >= size)
+        return -1;
+    *from = (size_t)a;
+    *to = (size_t)min(b, (unsigned long long)size - 1) + 1;
+    return 1;
+}
+
+/* Decode the path `t` of a request into the file name `name`, of at
+   least `strlen(t)` bytes.  Returns 0 on success. */
+
+static int decode(const char *t, char *name) {
+    if (*t++ != '/')
+        return -1;
+    for (; *t && *t != '?'; t++) {
+        unsigned int x;
+        if (*t != '%')
+            *name++ = *t;
+        else if (isxdigit((unsigned char)t[1])
+                 && isxdigit((unsigned char)t[2])
+                 && sscanf(t + 1, "%2x", &x) == 1 && x) {
+            *name++ = (char)x;
+            t += 2;
+        } else
+            return -1;
+    }
+    *name = '\0';
+    return 0;
+}
+
+
+
+/* Start the response to the request in the first `len` bytes of the
+   input of `c`, which end in an empty line. */
+
+static void start(struct conn *c, size_t len) {
+
+    char *p = c->in, *end = c->in + len - 2;
+    if (memchr(p, '\0', len)) { // the strings below would end early
+        c->keep = 0;
+        fail(c, "400 Bad Request", "");
+        return;
+    }
+    *end = '\0';
+
+    /* Request line, `end` is preceded by its `\r\n` at least. */
+    char *eol = strstr(p, "\r\n");
+    *eol = '\0';
+    char *method = p, *target = strchr(method, ' ');
+    char *version = target ? strchr(target + 1, ' ') : NULL;
+    if (! version) {
+        c->keep = 0;
+        fail(c, "400 Bad Request", "");
+        return;
+    }
+    *target++ = *version++ = '\0';
+    p = eol + 2;
+    int http10 = ! strcmp(version, "HTTP/1.0");
+    c->http10 = http10;
+    c->keep = ! http10;
+    if (! http10 && strcmp(version, "HTTP/1.1")) {
+        c->keep = 0;
+        fail(c, "505 HTTP Version Not Supported", "");
+        return;
+    }
+
+    /* Headers */
+    const char *rangeValue = NULL;
+    while (p < end) {
+        char *next = strstr(p, "\r\n"), *colon;
+        if (next)
+            *next = '\0';
+        if (! (colon = strchr(p, ':'))) {
+            c->keep = 0;
+            fail(c, "400 Bad Request", "");
+            return;
+        }
+        *colon++ = '\0';
+        while (*colon == ' ' || *colon == '\t')
+            colon++;
+        for (char *t = colon + strlen(colon);
+             t > colon && (t[-1] == ' ' || t[-1] == '\t'); )
+            *--t = '\0';
+        if (! strcasecmp(p, "Range"))
+            rangeValue = colon;
+        else if (! strcasecmp(p, "Connection") && strcasestr(colon, "close"))
+            c->keep = 0;
+        else if (! strcasecmp(p, "Connection")
+                 && strcasestr(colon, "keep-alive"))
+            c->keep = 1;
+        p = next ? next + 2 : end;
+    }
+
+    int head = ! strcmp(method, "HEAD");
+    if (! head && strcmp(method, "GET")) {
+        fail(c, "405 Method Not Allowed", "Allow: GET, HEAD\r\n");
+        return;
+    }
+
+    /* The file */
+    char name[REQUEST_MAX];
+    size_t ino;
+    struct file *fp;
+    if (decode(target, name) || ! otffs_lookup(&fs, name, &ino)
+        || ! (fp = otffs_file(&fs, ino))) {
+        fail(c, "404 Not Found", "");
+        return;
+    }
+    if (otffs_ready(&fs, fp)) {
+        fail(c, "500 Internal Server Error", "");
+        return;
+    }
+    if (! S_ISREG(fp->mode)) {
+        fail(c, "404 Not Found", "");
+        return;
+    }
+
+    size_t size = (size_t)fp->size, from = 0, to = size;
+    int r = rangeValue ? range(rangeValue, size, &from, &to) : 0;
+    if (r < 0) {
+        char extra[64];
+        snprintf(extra, sizeof(extra), "Content-Range: bytes */%zu\r\n",
+                 size);
+        fail(c, "416 Range Not Satisfiable", extra);
+        return;
+    }
+
+    c->srcFh = -1;
+    if (! head && from < to && fp->srcName
+        && (c->srcFh = openat(rootFh, fp->srcName, O_RDONLY)) < 0) {
+        fail(c, "500 Internal Server Error", "");
+        return;
+    }
+
+    char date[32];
+    httpDate(date, otffs_stamps(&fs, fp)->mtime);
+    size_t n = status(c, r ? "206 Partial Content" : "200 OK");
+    int m = snprintf(c->head + n, HEAD_MAX - n,
+                     "Content-Type: application/octet-stream\r\n"
+                     "Accept-Ranges: bytes\r\n"
+                     "Last-Modified: %s\r\n"
+                     "ETag: \"%016lx-%zx\"\r\n"
+                     "Content-Length: %zu\r\n",
+                     date, (unsigned long)fp->def, size, to - from);
+    ERRIF(m < 0 || (size_t)m >= HEAD_MAX - n);
+    n += (size_t)m;
+    if (r)
+        m = snprintf(c->head + n, HEAD_MAX - n,
+                     "Content-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                     from, to - 1, size);
+    else
+        m = snprintf(c->head + n, HEAD_MAX - n, "\r\n");
+    ERRIF(m < 0 || (size_t)m >= HEAD_MAX - n);
+
+    c->headLen = n + (size_t)m;
+    c->headOff = 0;
+    c->busy = 1;
+    if (head || from == to) {
+        c->fp = NULL;
+        c->off = c->end = 0;
+        c->bufLen = c->bufOff = 0;
+        return;
+    }
+    c->fp = fp;
+    c->off = from;
+    c->end = to;
+    c->bufLen = c->bufOff = 0;
+    c->cursor = otffs_cursor(fp);
+    if (! c->buf) {
+        c->buf = malloc(CHUNK);
+        ERRIF(! c->buf);
+    }
+}
+
+/* Start the response to the next complete request of `c`, if any.
+   Returns whether there is one. */
+
+static int next(struct conn *c) {
+    char *e = memmem(c->in, c->inLen, "\r\n\r\n", 4);
+    if (e) {
+        size_t len = (size_t)(e - c->in) + 4;
+        start(c, len);
+        c->inLen -= len;
+        memmove(c->in, c->in + len, c->inLen);
+        return 1;
+    }
+    if (c->inLen < REQUEST_MAX)
+        return 0;
+    c->keep = 0;
+    fail(c, "431 Request Header Fields Too Large", "");
+    return 1;
+}
+
+/* Send the response of `c`, for at most `BUDGET` chunks.  Returns 1
+   when it is sent, 0 if it is to be continued, and -1 if the
+   connection failed. */
+
+static int pump(struct conn *c) {
+
+    for (int b = 0; b < BUDGET; b++) {
+        if (c->bufOff == c->bufLen && c->off < c->end) {
+            size_t n = min((size_t)CHUNK, c->end - c->off);
+            otffs_fillFrom(c->fp, c->srcFh, c->cursor, c->off, n, c->buf);
+            c->off += n;
+            c->bufLen = n;
+            c->bufOff = 0;
+        }
+        struct iovec iov[2] = {
+            { c->head + c->headOff, c->headLen - c->headOff },
+            { c->buf + c->bufOff, c->bufLen - c->bufOff },
+        };
+        if (! iov[0].iov_len && ! iov[1].iov_len)
+            return 1;
+
+        ssize_t r = writev(c->fd, iov, 2);
+        if (r < 0)
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        size_t h = min((size_t)r, iov[0].iov_len);
+        c->headOff += h;
+        c->bufOff += (size_t)r - h;
+    }
+    return 0;
+}
+
+/* Clean up after the response of `c` is sent, or given up. */
+
+static void done(struct conn *c) {
+    if (c->srcFh >= 0)
+        close(c->srcFh);
+    c->srcFh = -1;
+    otffs_cursorFree(c->cursor);
+    c->cursor = NULL;
+    c->fp = NULL;
+    c->busy = 0;
+}
+
+static void drop(struct conn *c) {
+    done(c);
+    close(c->fd);
+    free(c->buf);
+    free(c);
+}
+
+
+
+/* Serve `c` after epoll reported `events`. */
+
+static void step(int ep, struct conn *c, unsigned int events) {
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        while (c->inLen < REQUEST_MAX) {
+            ssize_t r = read(c->fd, c->in + c->inLen, REQUEST_MAX - c->inLen);
+            if (r > 0) {
+                c->inLen += (size_t)r;
+                continue;
+            }
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r == 0 || errno != EAGAIN)
+                c->eof = 1;
+            break;
+        }
+    }
+
+    for (;;) {
+        if (! c->busy && ! next(c))
+            break;
+        int r = pump(c);
+        if (r < 0) {
+            drop(c);
+            return;
+        }
+        if (! r)
+            break;
+        done(c);
+        if (! c->keep) {
+            drop(c);
+            return;
+        }
+    }
+    if (! c->busy && c->eof) {
+        drop(c);
+        return;
+    }
+
+    /* Wait for room to send, or for requests. */
+    unsigned int want = c->busy ? EPOLLOUT : EPOLLIN;
+    if (want != c->events) {
+        struct epoll_event ev = { .events = want, .data.ptr = c };
+        ERRIF(epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev));
+        c->events = want;
+    }
+}
+
+/* Accept all pending connections into `ep`. */
+
+static void welcome(int ep) {
+    for (;;) {
+        int fd = accept4(listenFh, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                warn("Accepting connection");
+            return;
+        }
+        struct conn *c = new(struct conn);
+        c->fd = fd;
+        c->events = EPOLLIN;
+        c->eof = 0;
+        c->inLen = 0;
+        c->busy = 0;
+        c->srcFh = -1;
+        c->cursor = NULL;
+        c->fp = NULL;
+        c->buf = NULL;
+        c->bufLen = c->bufOff = 0;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        ERRIF(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev));
+    }
+}
+
+/* The event loop of a thread.  Every thread waits for connections on
+   the listening socket, exclusively, so one is woken per connection. */
+
+static void *loop(void *arg) {
+    (void)arg;
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    ERRIF(ep < 0);
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE,
+                              .data.ptr = NULL };
+    ERRIF(epoll_ctl(ep, EPOLL_CTL_ADD, listenFh, &ev));
+
+    struct epoll_event evs[EVENTS];
+    for (;;) {
+        int n = epoll_wait(ep, evs, EVENTS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        ERRIF(n < 0);
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.ptr)
+                step(ep, evs[i].data.ptr, evs[i].events);
+            else
+                welcome(ep);
+        }
+    }
+    return NULL;
+}
+
+
+
+/* Return a listening socket at the unix socket `path`. */
+
+static int listenUnix(const char *path) {
+    struct sockaddr_un a = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(a.sun_path))
+        errx(1, "Socket path too long: %s", path);
+    strcpy(a.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ERRIF(fd < 0);
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)))
+        err(1, "Failed to bind to %s", path);
+    ERRIF(listen(fd, SOMAXCONN));
+    return fd;
+}
+
+/* Return a listening socket at `hostPort`, like `localhost:8080`. */
+
+static int listenTcp(const char *hostPort) {
+    char *host = strdup(hostPort), *port = strrchr(host, ':');
+    ERRIF(! host);
+    if (! port)
+        errx(1, "Expected host:port, not %s", hostPort);
+    *port++ = '\0';
+
+    struct addrinfo hints = {
+        .ai_flags = AI_PASSIVE,
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    }, *ai;
+    int e = getaddrinfo(*host ? host : NULL, port, &hints, &ai);
+    if (e)
+        errx(1, "Cannot resolve %s: %s", hostPort, gai_strerror(e));
+
+    int fd = -1;
+    for (struct addrinfo *a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family,
+                    a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    a->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        ERRIF(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) || listen(fd, SOMAXCONN)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0)
+        err(1, "Failed to listen on %s", hostPort);
+    freeaddrinfo(ai);
+    free(host);
+    return fd;
+}
+
+
+
+int main(int argc, char **argv) {
+
+    const char *tcp = "127.0.0.1:8080", *unixPath = NULL;
+    long threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:u:j:")) != -1) {
+        switch (opt) {
+        case 'l': tcp = optarg; break;
+        case 'u': unixPath = optarg; break;
+        case 'j':
+            threads = atol(optarg);
+            if (threads < 1 || threads > MAX_THREADS)
+                errx(1, "Threads must be in 1..%d", MAX_THREADS);
+            break;
+        default: errx(1, "%s", usage);
+        }
+    }
+    if (optind != argc - 1)
+        errx(1, "%s", usage);
+    const char *config = argv[optind];
+
+    { /* Load the config, sources are relative to it. */
+        char *dir = strdup(config);
+        ERRIF(! dir);
+        rootFh = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+        if (rootFh < 0)
+            err(1, "Failed to open directory of %s", config);
+        free(dir);
+
+        int fh = open(config, O_RDONLY);
+        if (fh < 0)
+            err(1, "Failed to open config file: %s", config);
+        otffs_load(&fs, rootFh, fh, time(NULL), 0); // closes `fh`
+    }
+
+    listenFh = unixPath ? listenUnix(unixPath) : listenTcp(tcp);
+    ERRIF(signal(SIGPIPE, SIG_IGN) == SIG_ERR);
+
+    pthread_t t[MAX_THREADS];
+    for (long i = 1; i < threads; i++)
+        ERRIF(pthread_create(&t[i], NULL, loop, NULL));
+    loop(NULL);
+
+    return 0;
+}
@@ -0,0 +1,685 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include "overlay.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Export the files of an otffs config as network block devices, using
+   the NBD protocol, without mounting anything:
+
+       otffs-nbd [-l host:port | -u socket] [-s spill] <config> [default]
+
+   Every file is an export of its name, `default` also of the empty
+   name, which clients use if not told otherwise.  E.g.
+
+       $ ./otffs-nbd -u /tmp/nbd.sock otffsrc disk &
+       $ nbd-client -unix /tmp/nbd.sock /dev/nbd0
+       $ qemu-img info nbd+unix:///disk?socket=/tmp/nbd.sock
+
+   Files declared `writable` are exported copy-on-write: Written data
+   goes to the overlay of the file, in memory or spilled with `-s`,
+   shared by all connections, and is gone on exit.  Other files are
+   read-only.  All connections see the same data, so clients may use
+   several connections to one export.
+
+   Only the fixed newstyle handshake is supported, with the options
+   `EXPORT_NAME`, `LIST`, `INFO`, `GO`, `STRUCTURED_REPLY`, and the
+   meta context `base:allocation`.  Generated content is never a hole,
+   so block status reports every extent as allocated data.  Each
+   connection has its own thread, which answers its requests in order.
+   See https://github.com/NetworkBlockDevice/nbd/blob/master/doc/proto.md
+   for the protocol. */
+
+enum {
+    NBD_PORT = 10809,
+    OPTION_MAX = 1 << 16, // bytes of option data accepted
+    REQUEST_MAX = 1 << 25, // bytes of a read or write
+    BLOCK_PREFERRED = 4096,
+};
+
+/* Protocol constants, named as in the specification. */
+
+#define NBDMAGIC 0x4e42444d41474943
+#define IHAVEOPT 0x49484156454f5054
+#define REPLY_MAGIC 0x3e889045565a9
+#define REQUEST_MAGIC 0x25609513
+#define SIMPLE_REPLY_MAGIC 0x67446698
+#define STRUCTURED_REPLY_MAGIC 0x668e33ef
+
+enum {
+    FLAG_FIXED_NEWSTYLE = 1, FLAG_NO_ZEROES = 2, // handshake
+    FLAG_C_FIXED_NEWSTYLE = 1, FLAG_C_NO_ZEROES = 2, // client
+};
+
+enum { // transmission
+    FLAG_HAS_FLAGS = 1, FLAG_READ_ONLY = 2, FLAG_SEND_FLUSH = 4,
+    FLAG_SEND_DF = 128, FLAG_CAN_MULTI_CONN = 256,
+};
+
+enum {
+    OPT_EXPORT_NAME = 1, OPT_ABORT = 2, OPT_LIST = 3, OPT_INFO = 6,
+    OPT_GO = 7, OPT_STRUCTURED_REPLY = 8, OPT_LIST_META_CONTEXT = 9,
+    OPT_SET_META_CONTEXT = 10,
+};
+
+enum { REP_ACK = 1, REP_SERVER = 2, REP_INFO = 3, REP_META_CONTEXT = 4 };
+
+#define REP_ERR_UNSUP 0x80000001
+#define REP_ERR_INVALID 0x80000003
+#define REP_ERR_UNKNOWN 0x80000006
+
+enum { INFO_EXPORT = 0, INFO_BLOCK_SIZE = 3 };
+
+enum {
+    CMD_READ = 0, CMD_WRITE = 1, CMD_DISC = 2, CMD_FLUSH = 3,
+    CMD_BLOCK_STATUS = 7,
+};
+
+enum {
+    REPLY_FLAG_DONE = 1,
+    REPLY_TYPE_NONE = 0, REPLY_TYPE_OFFSET_DATA = 1,
+    REPLY_TYPE_BLOCK_STATUS = 5, REPLY_TYPE_ERROR = (1 << 15) + 1,
+};
+
+#define ALLOCATION_ID 1 // of the meta context `base:allocation`
+
+static const char *usage =
+    "usage: otffs-nbd [-l host:port | -u socket] [-s spill] <config>"
+    " [default]";
+
+static struct fileSystem fs;
+static int rootFh; // directory of the config
+static const char *defaultName; // export of the empty name, or NULL
+
+
+
+/* A client connection. */
+
+struct conn {
+    int fd;
+    int noZeroes; // client asked to skip padding
+    int structured; // structured replies negotiated
+    int allocation; // meta context `base:allocation` selected
+    struct file *fp; // export, once chosen
+    int srcFh; // source of `pass` files, else -1
+    struct otffs_cursor *cursor;
+};
+
+/* Read exactly `len` bytes from `fd`.  Returns 0 on success. */
+
+static int readAll(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len) {
+        ssize_t r = read(fd, p, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        p += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+/* Write all of `iov` to `fd`, modifying it.  Returns 0 on success. */
+
+static int writeAll(int fd, struct iovec *iov, int n) {
+    while (n) {
+        ssize_t r = writev(fd, iov, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        size_t w = (size_t)r;
+        for (; n && w >= iov->iov_len; n--, iov++)
+            w -= iov->iov_len;
+        if (n) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+/* Append big endian integers to a buffer at `*p`. */
+
+static void put16(char **p, uint16_t x) {
+    x = htobe16(x);
+    memcpy(*p, &x, 2);
+    *p += 2;
+}
+
+static void put32(char **p, uint32_t x) {
+    x = htobe32(x);
+    memcpy(*p, &x, 4);
+    *p += 4;
+}
+
+static void put64(char **p, uint64_t x) {
+    x = htobe64(x);
+    memcpy(*p, &x, 8);
+    *p += 8;
+}
+
+static uint32_t get32(const char *p) {
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return be32toh(x);
+}
+
+static uint64_t get64(const char *p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    return be64toh(x);
+}
+
+
+
+/* Return the file exported as `name`, of `len` bytes, ready to be
+   read, or `NULL`. */
+
+static struct file *lookup(const char *name, size_t len) {
+    char n[len + 1];
+    memcpy(n, name, len);
+    n[len] = '\0';
+
+    size_t ino;
+    struct file *fp;
+    if (! otffs_lookup(&fs, len || ! defaultName ? n : defaultName, &ino)
+        || ! (fp = otffs_file(&fs, ino)) || otffs_ready(&fs, fp)
+        || ! S_ISREG(fp->mode))
+        return NULL;
+    return fp;
+}
+
+static uint16_t transmissionFlags(const struct conn *c,
+                                  const struct file *fp) {
+    return (uint16_t)(FLAG_HAS_FLAGS | FLAG_CAN_MULTI_CONN
+                      | (fp->overlay ? FLAG_SEND_FLUSH : FLAG_READ_ONLY)
+                      | (c->structured ? FLAG_SEND_DF : 0));
+}
+
+/* Send the reply of type `type` to option `opt`, with `len` bytes of
+   `data`.  Returns 0 on success. */
+
+static int optReply(struct conn *c, uint32_t opt, uint32_t type,
+                    const void *data, size_t len) {
+    char h[20], *p = h;
+    put64(&p, REPLY_MAGIC);
+    put32(&p, opt);
+    put32(&p, type);
+    put32(&p, (uint32_t)len);
+    struct iovec iov[2] = { { h, sizeof(h) }, { (void *)data, len } };
+    return writeAll(c->fd, iov, 2);
+}
+
+/* Used by `haggle` for `LIST`: Send the name of every file. */
+
+struct list_ctx {
+    struct conn *c;
+    int failed;
+};
+
+static int listFun(char *name, size_t ino, struct list_ctx *ctx) {
+    if (ino == ROOT_INO || ctx->failed)
+        return 0;
+    size_t len = strlen(name);
+    char buf[4 + len], *p = buf;
+    put32(&p, (uint32_t)len);
+    memcpy(p, name, len);
+    ctx->failed = optReply(ctx->c, OPT_LIST, REP_SERVER, buf, sizeof(buf));
+    return 0;
+}
+
+/* Used by `haggle` for `INFO` and `GO`.  Returns 1 to start the
+   transmission, 0 to continue haggling, -1 on failure. */
+
+static int info(struct conn *c, uint32_t opt, const char *d, size_t len) {
+
+    uint32_t nameLen = len >= 6 ? get32(d) : 0;
+    if (len < 6 || nameLen > len - 6)
+        return optReply(c, opt, REP_ERR_INVALID, NULL, 0) ? -1 : 0;
+    const char *name = d + 4, *q = name + nameLen;
+    unsigned int requests = (unsigned int)(((unsigned char)q[0] << 8)
+                                           | (unsigned char)q[1]);
+    if (len - 4 - nameLen - 2 != 2 * (size_t)requests)
+        return optReply(c, opt, REP_ERR_INVALID, NULL, 0) ? -1 : 0;
+
+    struct file *fp = lookup(name, nameLen);
+    if (! fp)
+        return optReply(c, opt, REP_ERR_UNKNOWN, NULL, 0) ? -1 : 0;
+
+    char buf[14], *p = buf;
+    put16(&p, INFO_EXPORT);
+    put64(&p, (uint64_t)fp->size);
+    put16(&p, transmissionFlags(c, fp));
+    if (optReply(c, opt, REP_INFO, buf, 12))
+        return -1;
+
+    for (unsigned int i = 0; i < requests; i++) {
+        if (q[2 + 2 * i] != 0 || q[3 + 2 * i] != INFO_BLOCK_SIZE)
+            continue;
+        p = buf;
+        put16(&p, INFO_BLOCK_SIZE);
+        put32(&p, 1);
+        put32(&p, BLOCK_PREFERRED);
+        put32(&p, REQUEST_MAX);
+        if (optReply(c, opt, REP_INFO, buf, 14))
+            return -1;
+    }
+
+    if (optReply(c, opt, REP_ACK, NULL, 0))
+        return -1;
+    if (opt == OPT_INFO)
+        return 0;
+    c->fp = fp;
+    return 1;
+}
+
+/* Used by `haggle` for `LIST_META_CONTEXT` and `SET_META_CONTEXT`. */
+
+static int meta(struct conn *c, uint32_t opt, const char *d, size_t len) {
+
+    static const char ctx[] = "base:allocation";
+    uint32_t nameLen = len >= 8 ? get32(d) : 0;
+    if (len < 8 || nameLen > len - 8
+        || (opt == OPT_SET_META_CONTEXT && ! c->structured))
+        return optReply(c, opt, REP_ERR_INVALID, NULL, 0) ? -1 : 0;
+    if (! lookup(d + 4, nameLen))
+        return optReply(c, opt, REP_ERR_UNKNOWN, NULL, 0) ? -1 : 0;
+
+    const char *q = d + 4 + nameLen, *end = d + len;
+    uint32_t queries = get32(q);
+    int found = opt == OPT_LIST_META_CONTEXT && ! queries;
+    for (q += 4; queries--; ) {
+        if (end - q < 4 || get32(q) > (size_t)(end - q) - 4)
+            return optReply(c, opt, REP_ERR_INVALID, NULL, 0) ? -1 : 0;
+        uint32_t l = get32(q);
+        q += 4;
+        if ((l == sizeof(ctx) - 1 && ! memcmp(q, ctx, l))
+            || (opt == OPT_LIST_META_CONTEXT && l == 5
+                && ! memcmp(q, "base:", 5)))
+            found = 1;
+        q += l;
+    }
+
+    if (opt == OPT_SET_META_CONTEXT)
+        c->allocation = found;
+    if (found) {
+        char buf[4 + sizeof(ctx) - 1], *p = buf;
+        put32(&p, ALLOCATION_ID);
+        memcpy(p, ctx, sizeof(ctx) - 1);
+        if (optReply(c, opt, REP_META_CONTEXT, buf, sizeof(buf)))
+            return -1;
+    }
+    return optReply(c, opt, REP_ACK, NULL, 0) ? -1 : 0;
+}
+
+/* Do the handshake with `c`, until an export is chosen.  Returns 0 on
+   success. */
+
+static int haggle(struct conn *c) {
+
+    char buf[18], *p = buf;
+    put64(&p, NBDMAGIC);
+    put64(&p, IHAVEOPT);
+    put16(&p, FLAG_FIXED_NEWSTYLE | FLAG_NO_ZEROES);
+    struct iovec iov = { buf, 18 };
+    if (writeAll(c->fd, &iov, 1) || readAll(c->fd, buf, 4))
+        return -1;
+    uint32_t flags = get32(buf);
+    if (! (flags & FLAG_C_FIXED_NEWSTYLE)
+        || flags & ~(uint32_t)(FLAG_C_FIXED_NEWSTYLE | FLAG_C_NO_ZEROES))
+        return -1;
+    c->noZeroes = !! (flags & FLAG_C_NO_ZEROES);
+
+    char *data = malloc(OPTION_MAX);
+    ERRIF(! data);
+    for (int r = 0; ! r; ) {
+        char h[16];
+        if (readAll(c->fd, h, 16) || get64(h) != IHAVEOPT
+            || get32(h + 12) > OPTION_MAX
+            || readAll(c->fd, data, get32(h + 12))) {
+            r = -1;
+            break;
+        }
+        uint32_t opt = get32(h + 8), len = get32(h + 12);
+
+        switch (opt) {
+        case OPT_EXPORT_NAME: {
+            struct file *fp = lookup(data, len);
+            if (! fp) {
+                r = -1;
+                break;
+            }
+            char reply[10 + 124] = { 0 };
+            p = reply;
+            put64(&p, (uint64_t)fp->size);
+            put16(&p, transmissionFlags(c, fp));
+            iov = (struct iovec){ reply, c->noZeroes ? 10 : sizeof(reply) };
+            r = writeAll(c->fd, &iov, 1) ? -1 : 1;
+            c->fp = fp;
+            break;
+        }
+        case OPT_ABORT:
+            optReply(c, opt, REP_ACK, NULL, 0);
+            r = -1;
+            break;
+        case OPT_LIST: {
+            struct list_ctx ctx = { .c = c };
+            otffs_traverse(&fs, (avl_VisitorFun)listFun, &ctx);
+            r = ctx.failed || optReply(c, opt, REP_ACK, NULL, 0) ? -1 : 0;
+            break;
+        }
+        case OPT_INFO:
+        case OPT_GO:
+            r = info(c, opt, data, len);
+            break;
+        case OPT_STRUCTURED_REPLY:
+            c->structured = ! len;
+            r = optReply(c, opt, len ? REP_ERR_INVALID : REP_ACK, NULL, 0);
+            break;
+        case OPT_LIST_META_CONTEXT:
+        case OPT_SET_META_CONTEXT:
+            r = meta(c, opt, data, len);
+            break;
+        default:
+            r = optReply(c, opt, REP_ERR_UNSUP, NULL, 0);
+            break;
+        }
+    }
+    free(data);
+    return c->fp ? 0 : -1;
+}
+
+
+
+/* Produce [off, off+len) of the export of `c` into `buf`, with data
+   written to it. */
+
+static void produce(struct conn *c, size_t off, size_t len, char *buf) {
+    struct file *fp = c->fp;
+    if (! fp->overlay) {
+        otffs_fillFrom(fp, c->srcFh, c->cursor, off, len, buf);
+        return;
+    }
+    struct overlay_piece *piece;
+    size_t n = overlay_acquire(fp->overlay, off, len, &piece);
+    for (size_t i = 0; i < n; i++) {
+        char *base = buf + (piece[i].off - off);
+        if (piece[i].data)
+            memcpy(base, piece[i].data, piece[i].len);
+        else
+            otffs_fillFrom(fp, c->srcFh, c->cursor, piece[i].off,
+                           piece[i].len, base);
+    }
+    overlay_release(fp->overlay, piece, n);
+}
+
+/* Send the reply to the request `cookie`, with `error`, and `len`
+   bytes of `data` read at `off`.  Returns 0 on success. */
+
+static int reply(struct conn *c, uint64_t cookie, uint32_t error,
+                 uint64_t off, const char *data, size_t len) {
+    char h[40], *p = h;
+    if (! c->structured) {
+        put32(&p, SIMPLE_REPLY_MAGIC);
+        put32(&p, error);
+        put64(&p, cookie);
+    } else if (error) {
+        put32(&p, STRUCTURED_REPLY_MAGIC);
+        put16(&p, REPLY_FLAG_DONE);
+        put16(&p, REPLY_TYPE_ERROR);
+        put64(&p, cookie);
+        put32(&p, 6);
+        put32(&p, error);
+        put16(&p, 0);
+        len = 0;
+    } else {
+        put32(&p, STRUCTURED_REPLY_MAGIC);
+        put16(&p, REPLY_FLAG_DONE);
+        put16(&p, data ? REPLY_TYPE_OFFSET_DATA : REPLY_TYPE_NONE);
+        put64(&p, cookie);
+        put32(&p, data ? (uint32_t)(8 + len) : 0);
+        if (data)
+            put64(&p, off);
+    }
+    struct iovec iov[2] = {
+        { h, (size_t)(p - h) }, { (void *)data, data ? len : 0 },
+    };
+    return writeAll(c->fd, iov, 2);
+}
+
+/* Send the block status of [off, off+len): All data. */
+
+static int status(struct conn *c, uint64_t cookie, uint32_t len) {
+    char h[32], *p = h;
+    put32(&p, STRUCTURED_REPLY_MAGIC);
+    put16(&p, REPLY_FLAG_DONE);
+    put16(&p, REPLY_TYPE_BLOCK_STATUS);
+    put64(&p, cookie);
+    put32(&p, 12);
+    put32(&p, ALLOCATION_ID);
+    put32(&p, len);
+    put32(&p, 0);
+    struct iovec iov = { h, sizeof(h) };
+    return writeAll(c->fd, &iov, 1);
+}
+
+/* Answer the requests of `c` until it disconnects. */
+
+static void transmit(struct conn *c) {
+
+    char *buf = malloc(REQUEST_MAX);
+    ERRIF(! buf);
+    const uint64_t size = (uint64_t)c->fp->size;
+
+    for (;;) {
+        char h[28];
+        if (readAll(c->fd, h, 28) || get32(h) != REQUEST_MAGIC)
+            break;
+        uint16_t type = (uint16_t)(((unsigned char)h[6] << 8)
+                                   | (unsigned char)h[7]);
+        uint64_t cookie = get64(h + 8), off = get64(h + 16);
+        uint32_t len = get32(h + 24), error = 0;
+        int inRange = off <= size && len <= size - off;
+
+        if (type == CMD_DISC)
+            break;
+
+        if (type == CMD_WRITE) {
+            if (len > REQUEST_MAX || readAll(c->fd, buf, len))
+                break;
+            if (! c->fp->overlay)
+                error = EPERM;
+            else if (! inRange)
+                error = ENOSPC;
+            else
+                overlay_write(c->fp->overlay, (size_t)off, len, buf, NULL);
+            if (reply(c, cookie, error, 0, NULL, 0))
+                break;
+
+        } else if (type == CMD_READ) {
+            if (len > REQUEST_MAX || ! inRange)
+                error = EINVAL;
+            else
+                produce(c, (size_t)off, len, buf);
+            if (reply(c, cookie, error, off, error ? NULL : buf, len))
+                break;
+
+        } else if (type == CMD_BLOCK_STATUS && c->allocation) {
+            if (! len || ! inRange) {
+                if (reply(c, cookie, EINVAL, 0, NULL, 0))
+                    break;
+            } else if (status(c, cookie, len))
+                break;
+
+        } else if (type == CMD_FLUSH) {
+            if (reply(c, cookie, 0, 0, NULL, 0))
+                break;
+
+        } else if (reply(c, cookie, EINVAL, 0, NULL, 0))
+            break;
+    }
+
+    free(buf);
+}
+
+static void *serve(void *arg) {
+    struct conn *c = arg;
+    if (! haggle(c)) {
+        if (c->fp->srcName
+            && (c->srcFh = openat(rootFh, c->fp->srcName, O_RDONLY)) < 0)
+            warn("Failed to open source `%s`", c->fp->srcName);
+        else {
+            c->cursor = otffs_cursor(c->fp);
+            transmit(c);
+        }
+    }
+    if (c->srcFh >= 0)
+        close(c->srcFh);
+    otffs_cursorFree(c->cursor);
+    close(c->fd);
+    free(c);
+    return NULL;
+}
+
+
+
+/* Return a listening socket at the unix socket `path`. */
+
+static int listenUnix(const char *path) {
+    struct sockaddr_un a = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(a.sun_path))
+        errx(1, "Socket path too long: %s", path);
+    strcpy(a.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ERRIF(fd < 0);
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)))
+        err(1, "Failed to bind to %s", path);
+    ERRIF(listen(fd, SOMAXCONN));
+    return fd;
+}
+
+/* Return a listening socket at `hostPort`, like `localhost:10809`. */
+
+static int listenTcp(const char *hostPort) {
+    char *host = strdup(hostPort), *port = strrchr(host, ':');
+    ERRIF(! host);
+    if (! port)
+        errx(1, "Expected host:port, not %s", hostPort);
+    *port++ = '\0';
+
+    struct addrinfo hints = {
+        .ai_flags = AI_PASSIVE,
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    }, *ai;
+    int e = getaddrinfo(*host ? host : NULL, port, &hints, &ai);
+    if (e)
+        errx(1, "Cannot resolve %s: %s", hostPort, gai_strerror(e));
+
+    int fd = -1;
+    for (struct addrinfo *a = ai; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC,
+                    a->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        ERRIF(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) || listen(fd, SOMAXCONN)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0)
+        err(1, "Failed to listen on %s", hostPort);
+    freeaddrinfo(ai);
+    free(host);
+    return fd;
+}
+
+
+
+int main(int argc, char **argv) {
+
+    char tcp[64];
+    snprintf(tcp, sizeof(tcp), "127.0.0.1:%d", NBD_PORT);
+    const char *hostPort = tcp, *unixPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:u:s:")) != -1) {
+        switch (opt) {
+        case 'l': hostPort = optarg; break;
+        case 'u': unixPath = optarg; break;
+        case 's': {
+            int fh = open(optarg, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                          0600);
+            if (fh < 0)
+                err(1, "Failed to open spill file %s", optarg);
+            overlay_spill(fh);
+            break;
+        }
+        default: errx(1, "%s", usage);
+        }
+    }
+    if (optind != argc - 1 && optind != argc - 2)
+        errx(1, "%s", usage);
+    const char *config = argv[optind];
+    defaultName = argv[optind + 1];
+
+    { /* Load the config, sources are relative to it. */
+        char *dir = strdup(config);
+        ERRIF(! dir);
+        rootFh = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+        if (rootFh < 0)
+            err(1, "Failed to open directory of %s", config);
+        free(dir);
+
+        int fh = open(config, O_RDONLY);
+        if (fh < 0)
+            err(1, "Failed to open config file: %s", config);
+        otffs_load(&fs, rootFh, fh, time(NULL), 0); // closes `fh`
+    }
+
+    size_t ino;
+    if (defaultName && ! otffs_lookup(&fs, defaultName, &ino))
+        errx(1, "No definition of `%s` in %s", defaultName, config);
+
+    int listenFh = unixPath ? listenUnix(unixPath) : listenTcp(hostPort);
+    ERRIF(signal(SIGPIPE, SIG_IGN) == SIG_ERR);
+
+    pthread_attr_t attr;
+    ERRIF(pthread_attr_init(&attr));
+    ERRIF(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+
+    for (;;) {
+        int fd = accept4(listenFh, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                warn("Accepting connection");
+            continue;
+        }
+        struct conn *c = new(struct conn);
+        *c = (struct conn){ .fd = fd, .srcFh = -1 };
+        pthread_t t;
+        if (pthread_create(&t, &attr, serve, c)) {
+            warnx("Cannot start thread for connection");
+            close(fd);
+            free(c);
+        }
+    }
+}
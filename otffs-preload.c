@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A shim to read otffs files without going through FUSE, for
+   benchmarking readers without the file system in the measurement:
+
+       $ OTFFS_MOUNT=mnt OTFFS_CONFIG=otffsrc.copy \
+         LD_PRELOAD=./otffs-preload.so some-reader mnt/file
+
+   Files under the mountpoint `OTFFS_MOUNT` are opened through the
+   mount as usual, then read(2), pread(2), lseek(2) and fstat(2) on the
+   descriptor are served in the process, from the definitions in
+   `OTFFS_CONFIG`, which must be those otffs serves.  Like for
+   `otffs-cat`, sources of `pass` files are looked up relative to the
+   directory of the config.  The content is that of the mount.
+   Everything else goes to the mount: Writable files, files opened for
+   writing, paths relative to other directories than the working
+   directory, stdio(3), which opens files without open(2), and calls
+   not intercepted here, e.g. mmap(2).  copy_file_range(2) from an
+   intercepted descriptor fails with `EXDEV`, so callers fall back to
+   read(2).  Descriptors closed by close(2) or close_range(2) stop being
+   served.
+
+   The config is loaded on the first open(2), a relative mountpoint is
+   taken relative to the working directory then.  Opens by other
+   threads meanwhile go to the mount.  Later changes of the config are
+   not noticed.  The file offset is kept in the process, shared with
+   descriptors made by dup(2), dup2(2) and dup3(2), but not with those
+   made by fcntl(2), or with children.  Only for 64-bit systems, where
+   the `64` variants are the same as the plain ones. */
+
+#if __WORDSIZE != 64
+#error otffs-preload needs a 64-bit system
+#endif
+
+/* An intercepted descriptor. */
+
+struct shim {
+    struct file *fp;
+    int srcFh; // source of `pass` files, else -1
+    struct otffs_cursor *cursor;
+    struct stat st; // from the mount, when opened
+    pthread_mutex_t lock; // of `off`
+    size_t off;
+    unsigned int refs; // descriptors using it
+};
+
+static struct {
+    int (*open)(const char *, int, ...);
+    int (*openat)(int, const char *, int, ...);
+    int (*close)(int);
+    int (*close_range)(unsigned int, unsigned int, int);
+    int (*dup)(int);
+    int (*dup2)(int, int);
+    int (*dup3)(int, int, int);
+    ssize_t (*read)(int, void *, size_t);
+    ssize_t (*pread)(int, void *, size_t, off_t);
+    off_t (*lseek)(int, off_t, int);
+    int (*fstat)(int, struct stat *);
+    ssize_t (*copy_file_range)(int, off_t *, int, off_t *, size_t,
+                               unsigned int);
+} real;
+
+enum { sNone, sLoading, sReady, sOff };
+
+static int state = sNone;
+static struct fileSystem fs;
+static int rootFh; // directory of the config
+static char *mount; // absolute, without trailing `/`
+static size_t mountLen;
+static struct shim **shims; // by descriptor
+static size_t maxFd;
+
+
+
+/* Store the next definition of `name` in `*fun`.  Converting the result
+   of dlsym(3) is done through memory, as ISO C does not allow casting
+   it to a function pointer. */
+
+static void resolve(void *fun, const char *name) {
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (! sym)
+        errx(1, "otffs-preload: No `%s` to wrap", name);
+    memcpy(fun, &sym, sizeof(sym));
+}
+
+/* Resolve the wrapped functions.  Runs before `main`, on one thread. */
+
+static void __attribute__((constructor)) wrap(void) {
+    resolve(&real.open, "open");
+    resolve(&real.openat, "openat");
+    resolve(&real.close, "close");
+    resolve(&real.close_range, "close_range");
+    resolve(&real.dup, "dup");
+    resolve(&real.dup2, "dup2");
+    resolve(&real.dup3, "dup3");
+    resolve(&real.read, "read");
+    resolve(&real.pread, "pread");
+    resolve(&real.lseek, "lseek");
+    resolve(&real.fstat, "fstat");
+    resolve(&real.copy_file_range, "copy_file_range");
+}
+
+/* Load the config named by the environment, or switch the shim off.
+   Terminates the program if the config is broken. */
+
+static void load(void) {
+
+    const char *m = getenv("OTFFS_MOUNT"), *c = getenv("OTFFS_CONFIG");
+    if (! m || ! c || ! (mount = realpath(m, NULL))) {
+        __atomic_store_n(&state, sOff, __ATOMIC_RELEASE);
+        return;
+    }
+    mountLen = strlen(mount);
+    while (mountLen && mount[mountLen - 1] == '/')
+        mount[--mountLen] = '\0';
+
+    char *dir = strdup(c);
+    ERRIF(! dir);
+    rootFh = real.open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    if (rootFh < 0)
+        err(1, "otffs-preload: Failed to open directory of %s", c);
+    free(dir);
+
+    int fh = real.open(c, O_RDONLY);
+    if (fh < 0)
+        err(1, "otffs-preload: Failed to open config file: %s", c);
+    otffs_load(&fs, rootFh, fh, time(NULL), 0); // closes `fh`
+
+    long n = sysconf(_SC_OPEN_MAX);
+    maxFd = n > 0 ? (size_t)n : 1024;
+    struct shim **t = calloc(maxFd, sizeof(*shims));
+    ERRIF(! t);
+    __atomic_store_n(&shims, t, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&state, sReady, __ATOMIC_RELEASE);
+}
+
+/* Return whether the shim is ready, loading the config on first use.
+   Calls made while loading, also by `load` itself, are not served. */
+
+static int ready(void) {
+    int s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+    if (s == sNone
+        && __atomic_compare_exchange_n(&state, &s, sLoading, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        load();
+        s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+    }
+    return s == sReady;
+}
+
+/* Return the shim of descriptor `fd`, or `NULL`. */
+
+static struct shim *shim(int fd) {
+    if (fd < 0 || ! __atomic_load_n(&shims, __ATOMIC_ACQUIRE)
+        || (size_t)fd >= maxFd)
+        return NULL;
+    return __atomic_load_n(&shims[fd], __ATOMIC_ACQUIRE);
+}
+
+
+
+/* Stop serving `fd`, and free its shim unless used by another
+   descriptor. */
+
+static void detach(int fd) {
+    struct shim *s = shim(fd);
+    if (! s || ! __atomic_compare_exchange_n(&shims[fd], &s, NULL, 0,
+                                             __ATOMIC_ACQ_REL,
+                                             __ATOMIC_ACQUIRE))
+        return;
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    if (s->srcFh >= 0)
+        real.close(s->srcFh);
+    otffs_cursorFree(s->cursor);
+    ERRIF(pthread_mutex_destroy(&s->lock));
+    free(s);
+}
+
+/* Used by the wrappers of open(2): Serve `fd`, just opened as `path`
+   relative to `dirFh` with `flags`, if it is an otffs file that can be
+   served.  Returns `fd`. */
+
+static int adopt(int fd, int dirFh, const char *path, int flags) {
+
+    /* The number is fresh: A shim left over is of a descriptor closed
+       behind our back, e.g., by a system call made directly. */
+    if (fd >= 0)
+        detach(fd);
+
+    if (fd < 0 || (size_t)fd >= maxFd || (flags & O_ACCMODE) != O_RDONLY
+        || (*path != '/' && dirFh != AT_FDCWD))
+        return fd;
+
+    /* Find the name below the mountpoint. */
+    const char *name = NULL;
+    char cwd[PATH_MAX];
+    if (*path == '/') {
+        if (! strncmp(path, mount, mountLen) && path[mountLen] == '/')
+            name = path + mountLen + 1;
+    } else if (getcwd(cwd, sizeof(cwd))) {
+        size_t l = strcmp(cwd, "/") ? strlen(cwd) : 0;
+        if (l == mountLen && ! strcmp(cwd, mount))
+            name = path;
+        else if (l < mountLen && ! strncmp(cwd, mount, l)
+                 && mount[l] == '/' && ! strncmp(path, mount + l + 1,
+                                                 mountLen - l - 1)
+                 && path[mountLen - l - 1] == '/')
+            name = path + mountLen - l;
+    }
+    if (! name)
+        return fd;
+    while (! strncmp(name, "./", 2))
+        name += 2;
+
+    size_t ino;
+    struct file *fp;
+    if (! otffs_lookup(&fs, name, &ino) || ! (fp = otffs_file(&fs, ino))
+        || otffs_ready(&fs, fp) || ! S_ISREG(fp->mode) || fp->overlay)
+        return fd;
+
+    struct shim *s = new(struct shim);
+    *s = (struct shim){ .fp = fp, .srcFh = -1, .refs = 1 };
+    if (real.fstat(fd, &s->st)
+        || (fp->srcName
+            && (s->srcFh = real.openat(rootFh, fp->srcName, O_RDONLY)) < 0)) {
+        free(s);
+        return fd;
+    }
+    s->st.st_size = fp->size; // as the mount, unless reloaded since
+    s->cursor = otffs_cursor(fp);
+    ERRIF(pthread_mutex_init(&s->lock, NULL));
+    __atomic_store_n(&shims[fd], s, __ATOMIC_RELEASE);
+    return fd;
+}
+
+/* Serve `to`, just made a duplicate of `fd` unless negative, as `fd`.
+   Returns `to`. */
+
+static int attach(int fd, int to) {
+    if (to < 0 || fd == to)
+        return to;
+    detach(to);
+    struct shim *s = shim(fd);
+    if (s && (size_t)to < maxFd) {
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&shims[to], s, __ATOMIC_RELEASE);
+    }
+    return to;
+}
+
+/* Read up to `count` bytes at `off` of `s` into `buf`, return how
+   many. */
+
+static size_t serve(struct shim *s, void *buf, size_t count, size_t off) {
+    size_t size = (size_t)s->fp->size;
+    if (off >= size)
+        return 0;
+    size_t n = min(min(count, size - off), (size_t)SSIZE_MAX);
+    otffs_fillFrom(s->fp, s->srcFh, s->cursor, off, n, buf);
+    return n;
+}
+
+
+
+int open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    int fd = real.open(path, flags, mode);
+    return ready() ? adopt(fd, AT_FDCWD, path, flags) : fd;
+}
+
+int open64(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    return open(path, flags, mode);
+}
+
+int __open_2(const char *path, int flags) {
+    return open(path, flags);
+}
+
+int __open64_2(const char *path, int flags) {
+    return open(path, flags);
+}
+
+int openat(int dirFh, const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    int fd = real.openat(dirFh, path, flags, mode);
+    return ready() ? adopt(fd, dirFh, path, flags) : fd;
+}
+
+int openat64(int dirFh, const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    return openat(dirFh, path, flags, mode);
+}
+
+int close(int fd) {
+    detach(fd);
+    return real.close(fd);
+}
+
+int close_range(unsigned int first, unsigned int last, int flags) {
+    int r = real.close_range(first, last, flags);
+    if (! r && ! ((unsigned int)flags & CLOSE_RANGE_CLOEXEC))
+        for (size_t fd = first; fd <= last && fd < maxFd; fd++)
+            detach((int)fd);
+    return r;
+}
+
+int dup(int fd) {
+    return attach(fd, real.dup(fd));
+}
+
+int dup2(int fd, int to) {
+    return attach(fd, real.dup2(fd, to));
+}
+
+int dup3(int fd, int to, int flags) {
+    return attach(fd, real.dup3(fd, to, flags));
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    struct shim *s = shim(fd);
+    if (! s)
+        return real.read(fd, buf, count);
+    ERRIF(pthread_mutex_lock(&s->lock));
+    size_t n = serve(s, buf, count, s->off);
+    s->off += n;
+    ERRIF(pthread_mutex_unlock(&s->lock));
+    return (ssize_t)n;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t off) {
+    struct shim *s = shim(fd);
+    if (! s)
+        return real.pread(fd, buf, count, off);
+    if (off < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return (ssize_t)serve(s, buf, count, (size_t)off);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off_t off) {
+    return pread(fd, buf, count, off);
+}
+
+off_t lseek(int fd, off_t off, int whence) {
+    struct shim *s = shim(fd);
+    if (! s)
+        return real.lseek(fd, off, whence);
+
+    off_t size = s->fp->size, to = -1;
+    ERRIF(pthread_mutex_lock(&s->lock));
+    switch (whence) {
+    case SEEK_SET: to = off; break;
+    case SEEK_CUR: to = (off_t)s->off + off; break;
+    case SEEK_END: to = size + off; break;
+    case SEEK_DATA: to = off < size ? off : -1; break;
+    case SEEK_HOLE: to = off < size ? size : -1; break;
+    }
+    if (to >= 0)
+        s->off = (size_t)to;
+    ERRIF(pthread_mutex_unlock(&s->lock));
+
+    if (to < 0)
+        errno = whence == SEEK_DATA || whence == SEEK_HOLE ? ENXIO : EINVAL;
+    return to;
+}
+
+off_t lseek64(int fd, off_t off, int whence) {
+    return lseek(fd, off, whence);
+}
+
+int fstat(int fd, struct stat *buf) {
+    struct shim *s = shim(fd);
+    if (! s)
+        return real.fstat(fd, buf);
+    *buf = s->st;
+    return 0;
+}
+
+int fstat64(int fd, struct stat64 *buf) {
+    return fstat(fd, (struct stat *)buf);
+}
+
+ssize_t copy_file_range(int in, off_t *inOff, int out, off_t *outOff,
+                        size_t len, unsigned int flags) {
+    if (shim(in)) {
+        errno = EXDEV;
+        return -1;
+    }
+    return real.copy_file_range(in, inOff, out, outOff, len, flags);
+}
@@ -2,35 +2,153 @@
 #define _GNU_SOURCE // reallocarray
 
 #include "common.h"
+#include "flight.h"
 #include "fmap.h"
-#include "parser.h"
+#include "libotffs.h"
+#include "overlay.h"
+#include "plugin.h"
+#include "probes.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
+#include "wheel.h"
 #include <assert.h>
 #include <dirent.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fuse_lowlevel.h>
 #include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
 #define mmap DO_NOT_USE
 #define munmap DO_NOT_USE
 
+#if ROOT_INO != FUSE_ROOT_ID
+#error ROOT_INO must match FUSE_ROOT_ID
+#endif
+
 #define MAX_NAME_LENGTH 128
 #define DEFAULT_TIMEOUT 5.0
 
+/* Sequential reads of sources larger than `PREFETCH` have the kernel
+   read that far ahead, see `otf_prefetch`.  Of sources larger than
+   `DROP_MIN`, data more than `PREFETCH` behind the reader is dropped
+   from the page cache, unless other handles use the source too. */
+
+#define PREFETCH (8UL << 20)
+#define DROP_MIN (1UL << 30)
+
+
+/* All data of the file system is in the live snapshot.  Reloading the
+   config builds a new snapshot off to the side, and replaces the live
+   one under `liveLock`.  Handlers looking at the live snapshot hold
+   that lock for reading, see `LOCKED`.  Open files keep using the
+   snapshot they were opened in, which is freed after the last of them
+   is released. */
+
+struct snapshot {
+    struct fileSystem fs;
+    size_t refs; // open handles, plus one while live
+};
+
+static struct snapshot *live;
+static pthread_rwlock_t liveLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* How often the kernel has looked up each inode number, and not
+   forgotten yet, see `otf_forget`.  Numbers still known to the kernel
+   are not reused by a reload.  Grows with the live snapshot, under the
+   write lock, and is updated atomically under the read lock.  Images
+   cannot be reloaded, so this stays empty when serving one. */
+
+static STACK(size_t) lookups;
+
+/* An open file, see `otf_open`. */
+
+struct handle {
+    int fd; // the source of `pass` files, -1 otherwise
+    struct file *fp;
+    struct snapshot *s;
+    struct stats *stats; // of `fp`
+    size_t next; // offset after the previous read
+    size_t seq, rnd; // reads starting at `next`, or not
+    size_t ahead, behind; // range of the file not prefetched or dropped
+    struct source *source; // of `fd`, if larger than `DROP_MIN`, else NULL
+    struct otffs_cursor *cursor; // where reading stopped, may be NULL
+    int backing; // passthrough id of the inode, see `backings`, else 0
+    int shared; // counted in `backings`
+};
 
-struct fileSystem fs; // all data of the file system
+#define otf_handle(fi) ((struct handle *)(uintptr_t)(fi)->fh)
 
 struct timespec startupTime; // time of starting `otffs`
 
+/* Command line options of otffs, in addition to those of FUSE. */
+
+static struct options {
+    char *spill; // file to keep written data in, instead of memory
+    char *config; // config file, instead of `otffsrc` in the mountpoint
+    char *image; // image file, instead of a config, see `otf_compile`
+    char *trace; // file to record requests in, see `trace.h`
+    char *stats; // file to dump statistics to, see `otf_dump`
+    int lazy; // gather metadata of files on first lookup
+    unsigned int gather; // threads gathering metadata before mounting
+} options = {
+    .spill = NULL,
+    .config = NULL,
+    .image = NULL,
+    .trace = NULL,
+    .stats = NULL,
+    .lazy = 0,
+    .gather = 8,
+};
+
+static const struct fuse_opt otf_opts[] = {
+    { "spill=%s", offsetof(struct options, spill), 1 },
+    { "config=%s", offsetof(struct options, config), 1 },
+    { "image=%s", offsetof(struct options, image), 1 },
+    { "trace=%s", offsetof(struct options, trace), 1 },
+    { "stats=%s", offsetof(struct options, stats), 1 },
+    { "lazy", offsetof(struct options, lazy), 1 },
+    { "gather=%u", offsetof(struct options, gather), 0 },
+    FUSE_OPT_END
+};
+
 static int rootFh = -1; // handle of pre-mount mount point
 static int logFh = -1; // handle of log file, if open
+static struct fuse_session *session; // to invalidate kernel caches
+#ifdef FUSE_CAP_PASSTHROUGH
+static int passthrough; // kernel reads sources itself, see `otf_init`
+
+/* The kernel takes one backing file per inode, and refuses opens
+   served by otffs while it has one, and the other way round.  So
+   opens of a file that may pass through share the backing file of
+   the first one, and the last release closes it.  If registering
+   fails, the others are served by otffs as well.  The size of a file
+   with a backing file is fixed, see `otf_setattr_`.  By inode number,
+   which outlives reloads, unlike `struct file`.  Grows on demand,
+   under `backingLock`. */
+
+struct backing {
+    int id; // of the backing file, 0: none, served by otffs
+    unsigned int opens; // of the inode, sharing `id`
+};
+
+static STACK(struct backing) backings;
+static pthread_mutex_t backingLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 // logging to logFh
 #define log(fmt, ...) do {                                              \
@@ -53,16 +171,50 @@ static int logFh = -1; // handle of log file, if open
 
 
 
-/* Fill `buf` with the data from inode `ino`.  Some values are
-   hard-coded here.  Used by FUSE API and private functions. */
+/* Drop a reference to snapshot `s`, and free it if it was the last. */
 
-static int otf_stat(struct stat *buf, fuse_ino_t ino) {
+static void otf_unref(struct snapshot *s) {
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    otffs_free(&s->fs);
+    free(s);
+}
 
-    struct file *fp = AT(fs.files, ino);
+/* Make room in `lookups` for all inode numbers of the live snapshot.
+   The caller must hold `liveLock` for writing. */
+
+static void otf_track(void) {
+    while (! live->fs.image && lookups.used < live->fs.files.used) {
+        ENOUGH(lookups);
+        PUSH(lookups, 0);
+    }
+}
+
+/* Return the file with inode `ino` in the live snapshot, or `NULL`.
+   The caller must hold `liveLock`. */
+
+static struct file *otf_file(fuse_ino_t ino) {
+    return otffs_file(&live->fs, ino);
+}
+
+
+
+/* Fill `buf` with the data of `fp`, inode `ino` of `fs`, gathering it
+   first if necessary.  Some values are hard-coded here.  Used by FUSE
+   API and private functions. */
+
+static int otf_stat(struct stat *buf, struct fileSystem *fs, fuse_ino_t ino,
+                    struct file *fp) {
 
     if (! fp)
         return -EBADF;
 
+    int e = otffs_ready(fs, fp);
+    if (e)
+        return -e;
+
+    const struct stamps *st = otffs_stamps(fs, fp);
+
     // FIXME: would be nicer to have `_MAX` constants.
     assert((off_t)fp->size == fp->size);
     assert((blkcnt_t)(fp->size - 1) / 512 + 1 == (fp->size - 1) / 512 + 1);
@@ -73,9 +225,9 @@ static int otf_stat(struct stat *buf, fuse_ino_t ino) {
         .st_mode = fp->mode,
         .st_nlink = fp->nlink,
         .st_size = (off_t)fp->size,
-        .st_atime = fp->atime,
-        .st_mtime = fp->mtime,
-        .st_ctime = fp->ctime,
+        .st_atime = st->atime,
+        .st_mtime = st->mtime,
+        .st_ctime = st->ctime,
         .st_uid = getuid(),
         .st_gid = getgid(),
         .st_blksize = 1 << 10, // FIXME: why?
@@ -89,18 +241,32 @@ static int otf_stat(struct stat *buf, fuse_ino_t ino) {
 
 /* FUSE calls this function to request `struct stat` information. */
 
-static void otf_getattr(fuse_req_t req, fuse_ino_t ino,
-                    struct fuse_file_info *fi) {
-    (void) fi;
+static void otf_getattr_(fuse_req_t req, fuse_ino_t ino,
+                         struct fuse_file_info *fi) {
+
+    long start = trace_now();
+    PROBE3(getattr_entry, ino, 0, 0);
 
+    /* An open file may be gone from the live snapshot. */
     struct stat buf;
-    if (otf_stat(&buf, ino)) {
+    int e = fi
+        ? otf_stat(&buf, &otf_handle(fi)->s->fs, ino, otf_handle(fi)->fp)
+        : otf_stat(&buf, &live->fs, ino, otf_file(ino));
+    if (e == -EBADF) {
         log("getattr(%ld) = ENOENT", ino);
+        PROBE4(getattr_return, ino, 0, 0, -ENOENT);
         fuse_reply_err(req, ENOENT);
+    } else if (e) {
+        log("getattr(%ld) = EIO (source: %s)", ino, strerror(-e));
+        PROBE4(getattr_return, ino, 0, 0, -EIO);
+        fuse_reply_err(req, EIO);
     } else {
         log("getattr(%ld) = { .st_size=%zu, ...}", ino, buf.st_size);
+        PROBE4(getattr_return, ino, 0, 0, 0);
         ERRIF(fuse_reply_attr(req, &buf, DEFAULT_TIMEOUT));
     }
+
+    trace_add(TRACE_GETATTR, ino, 0, 0, NULL, start);
 }
 
 
@@ -108,50 +274,127 @@ static void otf_getattr(fuse_req_t req, fuse_ino_t ino,
 /* FUSE uses this function to Look up a directory entry by name and
    get its attributes. */
 
-static void otf_lookup(fuse_req_t req, fuse_ino_t parent,
-                       const char *name) {
+static void otf_lookup_(fuse_req_t req, fuse_ino_t parent,
+                        const char *name) {
 
-    struct file *pp = AT(fs.files, parent);
+    long start = trace_now();
+    PROBE3(lookup_entry, parent, 0, 0);
+    struct file *pp = otf_file(parent);
 
     if (! (pp && S_ISDIR(pp->mode))) {
         log("lookup(%ld, %s) = ENOTDIR", parent, name);
+        PROBE4(lookup_return, parent, 0, 0, -ENOTDIR);
         fuse_reply_err(req, ENOTDIR);
+        trace_add(TRACE_LOOKUP, parent, 0, 0, name, start);
         return;
     }
 
     /* FIXME get list of files for this specific directory.  Currently
        there's only one dir, containing all the files. */
 
-    ino_t ino;
-    if (avl_lookup(fs.names, name, &ino)) {
-        assert(AT(fs.files, ino));
+    size_t ino;
+    if (otffs_lookup(&live->fs, name, &ino)) {
+        struct file *fp = otf_file(ino);
+        assert(fp);
 
         struct fuse_entry_param e;
         e = (struct fuse_entry_param){
             .ino = ino,
+            .generation = otffs_stamps(&live->fs, fp)->generation,
             .attr_timeout = DEFAULT_TIMEOUT,
             .entry_timeout = DEFAULT_TIMEOUT,
         };
-        otf_stat(&e.attr, e.ino);
-        log("lookup(%s) = { .ino = %ld, ... }", name, ino);
+        int r = otf_stat(&e.attr, &live->fs, e.ino, fp);
+        if (r) {
+            log("lookup(%s) = EIO (source: %s)", name, strerror(-r));
+            PROBE4(lookup_return, parent, 0, 0, -EIO);
+            fuse_reply_err(req, EIO);
+            trace_add(TRACE_LOOKUP, parent, 0, 0, name, start);
+            return;
+        }
+        log("lookup(%s) = { .ino = %ld, .generation = %lu, ... }", name, ino,
+            (unsigned long)e.generation);
+        PROBE4(lookup_return, parent, 0, 0, ino);
+        if (ino < lookups.used)
+            __atomic_add_fetch(&AT(lookups, ino), 1, __ATOMIC_RELAXED);
         ERRIF(fuse_reply_entry(req, &e));
+        trace_add(TRACE_LOOKUP, parent, ino, 0, name, start);
         return;
     }
 
     log("lookup(%s) = ENOENT", name);
+    PROBE4(lookup_return, parent, 0, 0, -ENOENT);
     fuse_reply_err(req, ENOENT);
+    trace_add(TRACE_LOOKUP, parent, 0, 0, name, start);
+}
+
+
+
+/* Sources of open handles, by device and inode, counting the handles
+   using each.  The page cache of a source is shared by them, see
+   `otf_prefetch`.  Only of sources larger than `DROP_MIN`, which are
+   few. */
+
+struct source {
+    dev_t dev;
+    ino_t ino;
+    size_t handles; // using it
+    struct source *next;
+};
+
+static struct source *sources;
+static pthread_mutex_t sourcesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Count a handle using source `fd`.  Returns its entry in `sources`,
+   or `NULL` if `fd` cannot be looked at. */
+
+static struct source *otf_sourceOpen(int fd) {
+    struct stat st;
+    if (fstat(fd, &st))
+        return NULL;
+    ERRIF(pthread_mutex_lock(&sourcesLock));
+    struct source *s = sources;
+    while (s && (s->dev != st.st_dev || s->ino != st.st_ino))
+        s = s->next;
+    if (! s) {
+        s = new(struct source);
+        *s = (struct source){
+            .dev = st.st_dev, .ino = st.st_ino, .handles = 0, .next = sources,
+        };
+        sources = s;
+    }
+    __atomic_add_fetch(&s->handles, 1, __ATOMIC_RELAXED);
+    ERRIF(pthread_mutex_unlock(&sourcesLock));
+    return s;
+}
+
+static void otf_sourceClose(struct source *s) {
+    if (! s)
+        return;
+    ERRIF(pthread_mutex_lock(&sourcesLock));
+    if (! __atomic_sub_fetch(&s->handles, 1, __ATOMIC_RELAXED)) {
+        struct source **p = &sources;
+        while (*p != s)
+            p = &(*p)->next;
+        *p = s->next;
+        free(s);
+    }
+    ERRIF(pthread_mutex_unlock(&sourcesLock));
 }
 
 
 
 /* FUSE uses this function to open a file. */
 
-static void otf_open(fuse_req_t req, fuse_ino_t ino,
-                     struct fuse_file_info *fi) {
+static void otf_open_(fuse_req_t req, fuse_ino_t ino,
+                      struct fuse_file_info *fi) {
 
-    struct file *fp = AT(fs.files, ino);
+    PROBE3(open_entry, ino, 0, 0);
+
+    struct file *fp = otf_file(ino);
     if (! fp) {
         log("open(%ld) = EBADF", ino);
+        PROBE4(open_return, ino, 0, 0, -EBADF);
         fuse_reply_err(req, EBADF);
         return;
     }
@@ -159,36 +402,140 @@ static void otf_open(fuse_req_t req, fuse_ino_t ino,
     /* otffs only serves regular files */
     if (! S_ISREG(fp->mode)) {
         log("open(%ld) = EISDIR (not regular file)", ino);
+        PROBE4(open_return, ino, 0, 0, -EISDIR);
         fuse_reply_err(req, EISDIR); // FIXME not entirely correct
         return;
     }
 
     struct timespec now;
     if (clock_gettime(CLOCK_REALTIME, &now))
-        fp->atime = 0;
-    else
-        fp->atime = now.tv_sec;
+        now.tv_sec = 0;
+    otffs_stamps(&live->fs, fp)->atime = now.tv_sec;
 
     int fh;
     if (fp->srcName) { // file is backed by real file
         fh = openat(rootFh, fp->srcName, O_RDONLY);
         if (fh == -1) {
+            PROBE4(open_return, ino, 0, 0, -errno);
             fuse_reply_err(req, errno);
             return;
         };
     } else { // computed content
-        fh = 0; // FIXME is this a goo idea?
+        fh = -1;
     }
 
-    /* Return handle of open file for later use.  See `otf_read`. */
-    fi->fh = (unsigned long)fh;
+    /* Return handle of open file for later use.  See `otf_read`.  It
+       keeps the live snapshot, and so this definition of the file,
+       until released. */
+    struct handle *h = new(struct handle);
+    *h = (struct handle){
+        .fd = fh,
+        .fp = fp,
+        .s = live,
+        .stats = stats_get(&fp->stats),
+        .next = 0,
+        .seq = 0,
+        .rnd = 0,
+        .ahead = 0,
+        .behind = 0,
+        .source = fh >= 0 && (size_t)fp->srcSize >= DROP_MIN
+                  ? otf_sourceOpen(fh) : NULL,
+        .cursor = otffs_cursor(fp),
+        .backing = 0,
+        .shared = 0,
+    };
+    __atomic_add_fetch(&live->refs, 1, __ATOMIC_RELAXED);
+    fi->fh = (uintptr_t)h;
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    /* A read-only `pass` file of the size of its source, at full
+       speed, is just the source: Let the kernel read that without
+       asking.  Registering the source fails without CAP_SYS_ADMIN,
+       then serve it as usual.  Kernel reads do not stop at a smaller
+       size, so prefixes of the source are served as usual too.  The
+       size is compared under `backingLock`, see `otf_setattr_`. */
+    if (passthrough && fh >= 0 && ! fp->overlay && ! fp->profile
+        && (fi->flags & O_ACCMODE) == O_RDONLY) {
+        ERRIF(pthread_mutex_lock(&backingLock));
+        if (fp->size == fp->srcSize) {
+            while (backings.used <= ino) {
+                ENOUGH(backings);
+                PUSH(backings, ((struct backing){ .id = 0, .opens = 0 }));
+            }
+            struct backing *b = &AT(backings, ino);
+            if (! b->opens) {
+                int id = fuse_passthrough_open(req, fh);
+                b->id = id > 0 ? id : 0;
+            }
+            b->opens++;
+            if (b->id)
+                fi->backing_id = h->backing = b->id;
+            h->shared = 1;
+        }
+        ERRIF(pthread_mutex_unlock(&backingLock));
+    }
+#endif
 
-    log("open(%ld) = { .fh = %ld, ... } ", ino, fi->fh);
+    log("open(%ld) = { .fh = %d, .backing = %d, ... } ", ino, fh,
+        h->backing);
+    PROBE4(open_return, ino, 0, 0, 0);
     ERRIF(fuse_reply_open(req, fi));
 }
 
 
 
+/* Used by `otf_prefetch`: Give `advice` to the kernel about the range
+   [from, to) of a file repeating source `fd` of size `b`. */
+
+static void otf_advise(int fd, size_t b, size_t from, size_t to, int advice) {
+    size_t s = from % b, e = s + (to - from);
+    if (to - from >= b)
+        posix_fadvise(fd, 0, 0, advice);
+    else if (e <= b)
+        posix_fadvise(fd, (off_t)s, (off_t)(e - s), advice);
+    else {
+        posix_fadvise(fd, (off_t)s, (off_t)(b - s), advice);
+        posix_fadvise(fd, 0, (off_t)(e - b), advice);
+    }
+}
+
+/* Used by `otf_read` for `pass` files: When a handle reads its file
+   sequentially up to `end`, have the kernel read the source ahead
+   asynchronously, so the next reads do not fault on the mapping.  For
+   huge sources, drop what has been read from the page cache, so the
+   source does not evict everything else.  Dropping is for everyone,
+   so only done by the only handle using the source.  Concurrent
+   readers may race here, which only affects the hints given. */
+
+static void otf_prefetch(struct handle *h, size_t end, int seq) {
+
+    size_t b = (size_t)h->fp->srcSize;
+    if (b <= PREFETCH)
+        return;
+
+    if (! seq) {
+        __atomic_store_n(&h->ahead, end, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->behind, end, __ATOMIC_RELAXED);
+        return;
+    }
+
+    size_t ahead = __atomic_load_n(&h->ahead, __ATOMIC_RELAXED);
+    if (ahead < end + PREFETCH / 2) {
+        size_t from = max(ahead, end);
+        __atomic_store_n(&h->ahead, end + PREFETCH, __ATOMIC_RELAXED);
+        otf_advise(h->fd, b, from, end + PREFETCH, POSIX_FADV_WILLNEED);
+    }
+
+    size_t behind = __atomic_load_n(&h->behind, __ATOMIC_RELAXED);
+    if (h->source && behind + 2 * PREFETCH < end) {
+        __atomic_store_n(&h->behind, end - PREFETCH, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&h->source->handles, __ATOMIC_RELAXED) == 1)
+            otf_advise(h->fd, b, behind, end - PREFETCH, POSIX_FADV_DONTNEED);
+    }
+}
+
+
+
 /* Used by `otf_read` to implement `pass <realfile>` */
 
 static void otf_useFile(fuse_req_t req, int handle, struct file *fp,
@@ -221,6 +568,7 @@ static void otf_useFile(fuse_req_t req, int handle, struct file *fp,
            unmap. */
         struct mapping m;
         fmap_map(&m, handle, (size_t)s, (size_t)(e-s));
+        PROBE4(file, fp->ino, off, amount, 1);
         fuse_reply_buf(req, m.buf, (size_t)amount);
         fmap_unmap(&m);
 
@@ -253,6 +601,7 @@ static void otf_useFile(fuse_req_t req, int handle, struct file *fp,
         };
 
         /* send reply */
+        PROBE4(file, fp->ino, off, amount, c);
         ERRIF(fuse_reply_iov(req, vector, (int)(c)));
 
         /* unmap file, free `iovec` */
@@ -262,84 +611,271 @@ static void otf_useFile(fuse_req_t req, int handle, struct file *fp,
 }
 
 
-/* Used by `otf_read` to implement `fill integers` */
+/* Used by `otf_read` to implement `fill <algorithm>`.  Readers of the
+   same blocks at the same time share the work, see `flight.h`, except
+   for sequences, which are as cheap to make as to copy. */
 
-static void otf_useIntegers(fuse_req_t req, size_t off, size_t amount) {
-    size_t
-        s = sizeof(unsigned int), // size of one item
-        d = off % s, // delta between offset and item boundary
-        c = (amount + s - 1) / s, // number of items needed in memory
-        z = (size_t)off / s; // first item to put in memory
+static void otf_useAlgo(fuse_req_t req, struct handle *h, size_t off,
+                        size_t amount) {
 
-    unsigned int *buf = malloc(c * s);
+    char *buf = malloc(amount);
     ERRIF(! buf);
 
-    for (size_t i = 0; i < c; i++)
-        buf[i] = (unsigned int)(z + i);
-
-    fuse_reply_buf(req, (char *)buf + d, amount);
+    const struct file *fp = h->fp;
+    size_t shared = 0;
+    if (fp->srcSize == algoIntegers || fp->srcSize == algoChars
+        || fp->srcSize == algoSequence)
+        otffs_fillFrom(fp, -1, h->cursor, off, amount, buf);
+    else
+        shared = flight_fill(fp, h->cursor, off, amount, buf);
+    stats_produce(h->stats, amount - shared, shared);
+    fuse_reply_buf(req, buf, amount);
 
     free(buf);
 }
 
 
-/* Used by `otf_read` to implement `fill chars` */
+/* Used by `otf_read` to implement `fill plugin` for plugins that
+   provide a tile: The reply points into the tile, so nothing is
+   copied.  Falls back to `otf_useAlgo` if that takes more than
+   `IOV_MAX` pieces. */
+
+static void otf_useTile(fuse_req_t req, struct handle *h, const char *tile,
+                        size_t b, size_t off, size_t amount) {
 
-static void otf_useChars(fuse_req_t req, size_t off, size_t amount) {
-    size_t
-        s = sizeof(unsigned char), // size of one item
-        d = off % s, // delta between offset and item boundary
-        c = (amount + s - 1) / s, // number of items needed in memory
-        z = (size_t)off / s; // first item to put in memory
+    const size_t
+        s = off % b, // where in the first repetition to start
+        c = (s + amount + b - 1) / b; // total number of repetitions req'd
 
-    unsigned char *buf = malloc(c * s);
+    if (c > IOV_MAX) {
+        otf_useAlgo(req, h, off, amount);
+        return;
+    }
+
+    struct iovec *vector = calloc(c, sizeof(struct iovec));
+    ERRIF(! vector);
+
+    for (size_t i = 0, left = amount; i < c; i++) {
+        size_t from = i ? 0 : s;
+        vector[i] = (struct iovec){
+            .iov_base = (char *)tile + from, // never written through
+            .iov_len = min(b - from, left),
+        };
+        left -= vector[i].iov_len;
+    }
+
+    PROBE4(tile, h->fp->ino, off, amount, c);
+    ERRIF(fuse_reply_iov(req, vector, (int)c));
+    free(vector);
+}
+
+
+/* Used by `otf_read` for writable files: Data written to the file is
+   merged with the generated content into a single reply.  Only the
+   holes between written extents are generated. */
+
+static void otf_useOverlay(fuse_req_t req, struct handle *h, size_t off,
+                           size_t amount) {
+
+    struct file *fp = h->fp;
+    struct overlay_piece *piece;
+    size_t n = overlay_acquire(fp->overlay, off, amount, &piece);
+
+    char *buf = malloc(amount);
     ERRIF(! buf);
 
-    for (size_t i = 0; i < c; i++)
-        buf[i] = (unsigned char)(z + i);
+    struct iovec *vector = calloc(n, sizeof(struct iovec));
+    ERRIF(! vector);
+
+    for (size_t i = 0; i < n; i++) {
+        char *base = buf + (piece[i].off - off);
+        if (! piece[i].data)
+            otffs_fillFrom(fp, h->fd, h->cursor, piece[i].off, piece[i].len,
+                           base);
+        vector[i] = (struct iovec){
+            .iov_base = piece[i].data ? (char *)piece[i].data : base,
+            .iov_len = piece[i].len
+        };
+    }
 
-    fuse_reply_buf(req, (char *)buf + d, amount);
+    PROBE4(overlay, fp->ino, off, amount, n);
+    ERRIF(fuse_reply_iov(req, vector, (int)n));
 
+    overlay_release(fp->overlay, piece, n);
+    free(vector);
     free(buf);
 }
 
 
+/* Used by `otf_read` for files with a performance profile: The reply
+   is produced right away, but sent by the timer wheel when the
+   emulated device would have completed the request.  This does not
+   block the thread serving the request. */
+
+struct deferred {
+    fuse_req_t req;
+    char *buf;
+    size_t len;
+};
+
+static void otf_replyLater(struct deferred *d) {
+    /* Requests may be interrupted meanwhile, or the file system
+       unmounted, see `wheel_stop`. */
+    int e = (fuse_reply_buf)(d->req, d->buf, d->len);
+    if (e && e != -ENOENT && e != -ENODEV) {
+        errno = -e;
+        err(1, "Fatal fuse_reply_buf at " __FILE__ ":%d", __LINE__);
+    }
+    free(d->buf);
+    free(d);
+}
+
+static void otf_useProfile(fuse_req_t req, struct handle *h, size_t off,
+                           size_t amount) {
+
+    struct file *fp = h->fp;
+    long now = profile_now();
+
+    struct deferred *d = new(struct deferred);
+    *d = (struct deferred){ .req = req, .buf = malloc(amount), .len = amount };
+    ERRIF(! d->buf);
+
+    if (fp->overlay) {
+        struct overlay_piece *piece;
+        size_t n = overlay_acquire(fp->overlay, off, amount, &piece);
+        for (size_t i = 0; i < n; i++) {
+            char *dst = d->buf + (piece[i].off - off);
+            if (piece[i].data)
+                memcpy(dst, piece[i].data, piece[i].len);
+            else
+                otffs_fillFrom(fp, h->fd, h->cursor, piece[i].off,
+                               piece[i].len, dst);
+        }
+        overlay_release(fp->overlay, piece, n);
+    } else {
+        otffs_fillFrom(fp, h->fd, h->cursor, off, amount, d->buf);
+    }
+
+    long due = profile_due(fp->profile, amount, now);
+    PROBE4(profile, fp->ino, off, amount, due - now);
+    wheel_at(due, (wheel_Fun)otf_replyLater, d);
+}
+
+
 /* FUSE uses this function to read data from a file. */
 
 static void otf_read(fuse_req_t req, fuse_ino_t ino, size_t len, off_t _off,
                      struct fuse_file_info *fi) {
 
+    long start = trace_now();
+    PROBE3(read_entry, ino, _off, len);
+
     if (_off < 0) {
+        PROBE4(read_return, ino, _off, len, -EINVAL);
         fuse_reply_err(req, EINVAL);
         return;
     }
     size_t off = (size_t)_off;
 
-    struct file *fp = AT(fs.files, ino);
-
-    if (! fp) {
-        log("read(%ld, %zu, %zu) = EBADF", ino, off, len);
-        fuse_reply_err(req, EBADF);
-        return;
-    }
+    /* Not the live snapshot: Open files keep their definition. */
+    struct handle *h = otf_handle(fi);
+    struct file *fp = h->fp;
 
     if (len == 0 || off >= (size_t)fp->size) {
         log("read(%ld, %zu, %zu) returns 0 bytes", ino, off, len);
+        PROBE4(read_return, ino, off, len, 0);
         fuse_reply_buf(req, NULL, 0);
+        trace_add(TRACE_READ, ino, off, len, NULL, start);
         return;
     }
 
     size_t amount = min(len, (size_t)fp->size - off);
+    const char *tile;
+    size_t tileLen;
+
+    /* Requests on one handle may overtake each other, so this is only
+       an estimate. */
+    int seq = off == __atomic_exchange_n(&h->next, off + amount,
+                                         __ATOMIC_RELAXED);
+    __atomic_add_fetch(seq ? &h->seq : &h->rnd, 1, __ATOMIC_RELAXED);
+    stats_read(h->stats, off, amount, seq);
+    if (h->fd >= 0)
+        otf_prefetch(h, off + amount, seq);
 
     log("read(%ld, %zu, %zu) returns %zu bytes", ino, off, len, amount);
-    if (fp->srcName)
-        otf_useFile(req, (int)(fi->fh), fp, off, amount);
-    else if (fp->srcSize == algoIntegers)
-        otf_useIntegers(req, off, amount);
-    else if (fp->srcSize == algoChars)
-        otf_useChars(req, off, amount);
+    if (fp->profile)
+        otf_useProfile(req, h, off, amount);
+    else if (fp->overlay)
+        otf_useOverlay(req, h, off, amount);
+    else if (fp->srcName)
+        otf_useFile(req, h->fd, fp, off, amount);
+    else if (fp->plugin && (tile = plugin_tile(fp->plugin, &tileLen)))
+        otf_useTile(req, h, tile, tileLen, off, amount);
     else
-        assert(0);
+        otf_useAlgo(req, h, off, amount);
+    PROBE4(read_return, ino, off, len, amount);
+
+    /* Replies deferred by a profile are not waited for, the trace
+       shows the time otffs spent. */
+    trace_add(TRACE_READ, ino, off, len, NULL, start);
+}
+
+
+
+/* Used by `otf_write`: Set time stamp `*t` to `now`, unless a
+   concurrent write has set it later already. */
+
+static void otf_touch(time_t *t, time_t now) {
+    time_t old = __atomic_load_n(t, __ATOMIC_RELAXED);
+    while (old < now
+           && ! __atomic_compare_exchange_n(t, &old, now, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+        ;
+}
+
+/* FUSE uses this function to write data to a file.  Only files
+   declared `writable` accept data, which is kept in their overlay. */
+
+static void otf_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+                      size_t len, off_t _off, struct fuse_file_info *fi) {
+
+    PROBE3(write_entry, ino, _off, len);
+
+    if (_off < 0) {
+        PROBE4(write_return, ino, _off, len, -EINVAL);
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    size_t off = (size_t)_off;
+
+    struct file *fp = otf_handle(fi)->fp;
+
+    if (! fp->overlay) {
+        log("write(%ld, %zu, %zu) = EROFS", ino, off, len);
+        PROBE4(write_return, ino, off, len, -EROFS);
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+
+    if (off + len > SSIZE_MAX || off + len < off) {
+        log("write(%ld, %zu, %zu) = EFBIG", ino, off, len);
+        PROBE4(write_return, ino, off, len, -EFBIG);
+        fuse_reply_err(req, EFBIG);
+        return;
+    }
+
+    overlay_write(fp->overlay, off, len, buf, &fp->size);
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now))
+        now.tv_sec = 0;
+    struct stamps *st = otffs_stamps(&otf_handle(fi)->s->fs, fp);
+    otf_touch(&st->mtime, now.tv_sec);
+    otf_touch(&st->ctime, now.tv_sec);
+
+    log("write(%ld, %zu, %zu) = %zu", ino, off, len, len);
+    PROBE4(write_return, ino, off, len, len);
+    ERRIF(fuse_reply_write(req, len));
 }
 
 
@@ -357,7 +893,8 @@ struct addFun_ctx {
    its metadata to the response to be sent back to FUSE. */
 
 static int otf_addFun(char *name, ino_t ino, struct addFun_ctx *ptr) {
-    assert(AT(fs.files, ino));
+    struct file *fp = otf_file(ino);
+    assert(fp);
 
     /* First calculate req'd amount of space... */
     size_t oldsize = ptr->s;
@@ -366,9 +903,12 @@ static int otf_addFun(char *name, ino_t ino, struct addFun_ctx *ptr) {
     ERRIF(! ptr->p);
 
     /* ...then really fill the buffer.  Construction as in FUSE
-       example code. */
-    struct stat buf;
-    otf_stat(&buf, ino);
+       example code.  Only inode and type are used, so do not gather
+       metadata here. */
+    struct stat buf = {
+        .st_ino = ino,
+        .st_mode = S_ISDIR(fp->mode) ? S_IFDIR : S_IFREG,
+    };
     fuse_add_direntry(ptr->r, ptr->p + oldsize, ptr->s - oldsize,
                       name, &buf, (off_t)ptr->s);
 
@@ -377,19 +917,23 @@ static int otf_addFun(char *name, ino_t ino, struct addFun_ctx *ptr) {
 
 /* FUSE uses this function to read a directory. */
 
-static void otf_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
-                        off_t off, struct fuse_file_info *fi) {
+static void otf_readdir_(fuse_req_t req, fuse_ino_t ino, size_t size,
+                         off_t off, struct fuse_file_info *fi) {
     (void)fi;
 
+    PROBE3(readdir_entry, ino, off, size);
+
     /* otffs provides only one directory: root. */
     if (ino != FUSE_ROOT_ID) {
         log("readdir(%ld) = ENOTDIR", ino);
+        PROBE4(readdir_return, ino, off, size, -ENOTDIR);
         fuse_reply_err(req, ENOTDIR);
         return;
     }
 
     if ((size_t)off >= size) {
         log("readdir(%ld) returns 0 bytes", ino);
+        PROBE4(readdir_return, ino, off, size, 0);
         fuse_reply_buf(req, NULL, 0);
         return;
     }
@@ -401,10 +945,11 @@ static void otf_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
     };
 
     // FIXME: better implement a “cursor” in the avl tree
-    avl_traverse(fs.names, (avl_VisitorFun)otf_addFun, &buf);
+    otffs_traverse(&live->fs, (avl_VisitorFun)otf_addFun, &buf);
 
     size_t ret = min(buf.s - (size_t)off, size);
     log("readdir(%ld) returns %zu bytes", ino, ret);
+    PROBE4(readdir_return, ino, off, size, ret);
     fuse_reply_buf(req, buf.p + off, ret);
 
     free(buf.p);
@@ -418,93 +963,144 @@ static void otf_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
 static void otf_release(fuse_req_t req, fuse_ino_t ino,
                         struct fuse_file_info *fi) {
 
-    (void)req;
+    PROBE3(release_entry, ino, 0, 0);
 
-    struct file *fp = AT(fs.files, ino);
+    struct handle *h = otf_handle(fi);
 
-    if (! fp) {
-        log("release(%ld) = EBADF", ino);
-        fuse_reply_err(req, EBADF);
-        return;
+    /* If backed by real file, release that. */
+#ifdef FUSE_CAP_PASSTHROUGH
+    if (h->shared) {
+        ERRIF(pthread_mutex_lock(&backingLock));
+        struct backing *b = &AT(backings, ino);
+        if (! --b->opens && b->id) {
+            fuse_passthrough_close(req, b->id);
+            b->id = 0;
+        }
+        ERRIF(pthread_mutex_unlock(&backingLock));
     }
+#endif
+    otf_sourceClose(h->source);
+    if (h->fd >= 0)
+        close(h->fd);
 
-    /* If backed by real file, release that. */
-    if (fp->srcName)
-        close((int)(fi->fh));
+    stats_handle(h->stats, h->seq, h->rnd);
+    otffs_cursorFree(h->cursor);
+
+    otf_unref(h->s);
+    free(h);
 
     log("release(%ld) = 0", ino);
+    PROBE4(release_return, ino, 0, 0, 0);
     fuse_reply_err(req, 0);
 }
 
 
 
-/* Used by `otf_unlink` to remove a file from the file name index. */
+/* Used by FUSE to remove a file.  Its inode stays with the snapshot,
+   as the file may still be open. */
 
-static int otf_delFun(char *key, ino_t ino, ino_t *old) {
-    assert(AT(fs.files, ino));
+static void otf_unlink_(fuse_req_t req, fuse_ino_t parent, const char *name) {
 
-    *old = ino;
-    free(key);
-    return 0;
-}
+    PROBE3(unlink_entry, parent, 0, 0);
 
-/* Used by FUSE to remove a file. */
-
-static void otf_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
-
-    (void)parent;
-
-    ino_t ino;
-    if (avl_deleteWith((avl_VisitorFun)otf_delFun, fs.names, name, &ino)) {
-        struct file *fp = AT(fs.files, ino);
-        assert(fp);
-        free(fp);
-        AT(fs.files, ino) = NULL;
+    size_t ino;
+    if (otffs_unlink(&live->fs, name, &ino)) {
         log("unlink(%s) = 0", name);
+        PROBE4(unlink_return, parent, 0, 0, 0);
         fuse_reply_err(req, 0);
         return;
     }
 
     log("unlink(%s) = ENOENT", name);
+    PROBE4(unlink_return, parent, 0, 0, -ENOENT);
     fuse_reply_err(req, ENOENT);
 }
 
 
 
+/* FUSE uses this function when the kernel drops `nlookup` of its
+   references to inode `ino`, taken by `otf_lookup`. */
+
+static void otf_forget_(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    PROBE3(forget_entry, ino, 0, nlookup);
+    if (ino < lookups.used)
+        __atomic_sub_fetch(&AT(lookups, ino), nlookup, __ATOMIC_RELAXED);
+    PROBE4(forget_return, ino, 0, nlookup, 0);
+    fuse_reply_none(req);
+}
+
+
+
 /* Used by FUSE to change attributes.  This allows tochange file mode,
    size, and time stamps, at runtime. */
 
-void otf_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
-                 int to_set, struct fuse_file_info *fi) {
+static void otf_setattr_(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                         int to_set, struct fuse_file_info *fi) {
 
-    (void)attr; (void)fi;
+    PROBE3(setattr_entry, ino, 0, 0);
+
+    struct fileSystem *fs = fi ? &otf_handle(fi)->s->fs : &live->fs;
+    struct file *fp = fi ? otf_handle(fi)->fp : otf_file(ino);
 
-    struct file *fp = AT(fs.files, ino);
-    
     if (! fp) {
         log("setattr(%ld) = EBADF", ino);
+        PROBE4(setattr_return, ino, 0, 0, -EBADF);
         fuse_reply_err(req, EBADF);
         return;
     }
 
     if ((FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID) & to_set) {
         log("setattr(%ld, UID/GID) = EPERM", ino);
+        PROBE4(setattr_return, ino, 0, 0, -EPERM);
         fuse_reply_err(req, EPERM);
         return;
     }
 
+#ifdef FUSE_CAP_PASSTHROUGH
+    /* The kernel reads files passed through from their source, past a
+       smaller size, and not repeating it up to a larger one.  So their
+       size stays while they are open.  `backingLock` is held until it
+       is changed, so no open passes through meanwhile. */
+    int resize = passthrough && (FUSE_SET_ATTR_SIZE & to_set);
+    if (resize) {
+        ERRIF(pthread_mutex_lock(&backingLock));
+        if (ino < backings.used && AT(backings, ino).id) {
+            ERRIF(pthread_mutex_unlock(&backingLock));
+            log("setattr(%ld, SIZE) = EBUSY (passed through)", ino);
+            PROBE4(setattr_return, ino, 0, 0, -EBUSY);
+            fuse_reply_err(req, EBUSY);
+            return;
+        }
+    }
+#endif
+
     struct timespec now;
     if (clock_gettime(CLOCK_REALTIME, &now))
         now.tv_sec = 0;
 
-    fp->ctime = now.tv_sec;
+    /* Writes may run concurrently, see `otf_write`.  The size of
+       writable files is changed under the lock of their overlay. */
+    struct stamps *st = otffs_stamps(fs, fp);
+#define set(field, val) __atomic_store_n(&field, (val), __ATOMIC_RELAXED)
+
+    set(st->ctime, now.tv_sec);
     
     if (FUSE_SET_ATTR_MODE & to_set) fp->mode = attr->st_mode;
-    if (FUSE_SET_ATTR_SIZE & to_set) fp->size = attr->st_size;
-    if (FUSE_SET_ATTR_ATIME & to_set) fp->atime = attr->st_atime;
-    if (FUSE_SET_ATTR_MTIME & to_set) fp->mtime = attr->st_mtime;
-    if (FUSE_SET_ATTR_ATIME_NOW & to_set) fp->atime = now.tv_sec;
-    if (FUSE_SET_ATTR_MTIME_NOW & to_set) fp->mtime = now.tv_sec;
+    if (FUSE_SET_ATTR_SIZE & to_set) {
+        if (fp->overlay)
+            overlay_truncate(fp->overlay, (size_t)attr->st_size, &fp->size);
+        else
+            set(fp->size, attr->st_size);
+    }
+    if (FUSE_SET_ATTR_ATIME & to_set) set(st->atime, attr->st_atime);
+    if (FUSE_SET_ATTR_MTIME & to_set) set(st->mtime, attr->st_mtime);
+    if (FUSE_SET_ATTR_ATIME_NOW & to_set) set(st->atime, now.tv_sec);
+    if (FUSE_SET_ATTR_MTIME_NOW & to_set) set(st->mtime, now.tv_sec);
+#undef set
+#ifdef FUSE_CAP_PASSTHROUGH
+    if (resize)
+        ERRIF(pthread_mutex_unlock(&backingLock));
+#endif
 
     if (to_set & ~(
         FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID |
@@ -513,25 +1109,86 @@ void otf_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
         FUSE_SET_ATTR_CTIME
     )) {
         log("setattr(%ld, set=0x%X, ...) not implemented", ino, to_set);
+        PROBE4(setattr_return, ino, 0, 0, -ENOSYS);
         fuse_reply_err(req, ENOSYS);
     } else {
         log("setattr(%ld, ...)", ino);
+        PROBE4(setattr_return, ino, 0, 0, 0);
         struct stat buf;
-        otf_stat(&buf, ino);
+        otf_stat(&buf, fs, ino, fp);
         ERRIF(fuse_reply_attr(req, &buf, DEFAULT_TIMEOUT));
     }
 }
 
 
 
+/* Run `fun_` with `liveLock` held (`rw` is `rd` or `wr`), so the live
+   snapshot is not replaced while in use.  Handlers working on an open
+   file only use its handle, and need no lock. */
+
+#define LOCKED(rw, fun, params, args)                           \
+    static void fun params {                                    \
+        ERRIF(pthread_rwlock_##rw##lock(&liveLock));            \
+        fun##_ args;                                            \
+        ERRIF(pthread_rwlock_unlock(&liveLock));                \
+    }
+
+LOCKED(rd, otf_getattr,
+       (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi),
+       (req, ino, fi))
+LOCKED(rd, otf_lookup,
+       (fuse_req_t req, fuse_ino_t parent, const char *name),
+       (req, parent, name))
+LOCKED(rd, otf_open,
+       (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi),
+       (req, ino, fi))
+LOCKED(rd, otf_readdir,
+       (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+        struct fuse_file_info *fi),
+       (req, ino, size, off, fi))
+LOCKED(wr, otf_unlink,
+       (fuse_req_t req, fuse_ino_t parent, const char *name),
+       (req, parent, name))
+LOCKED(rd, otf_forget,
+       (fuse_req_t req, fuse_ino_t ino, uint64_t nlookup),
+       (req, ino, nlookup))
+LOCKED(rd, otf_setattr,
+       (fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+        struct fuse_file_info *fi),
+       (req, ino, attr, to_set, fi))
+
+
+
+/* FUSE calls this before serving requests.  Have the kernel read
+   suitable `pass` files from their sources directly, if it can, unless
+   reads are traced. */
+
+static void otf_init(void *userdata, struct fuse_conn_info *conn) {
+    (void)userdata;
+#ifdef FUSE_CAP_PASSTHROUGH
+    if (! options.trace && conn->capable & FUSE_CAP_PASSTHROUGH) {
+        conn->want |= FUSE_CAP_PASSTHROUGH;
+        passthrough = 1;
+        ALLOCATE(backings, 64);
+    }
+#else
+    (void)conn;
+#endif
+}
+
+
+
 /* Tell FUSE which functions are implemented.  All of them must be
    defined above. */
 
 static struct fuse_lowlevel_ops ops = {
+    .init = otf_init,
     .getattr = otf_getattr,
     .lookup = otf_lookup,
+    .forget = otf_forget,
     .open = otf_open,
     .read = otf_read,
+    .write = otf_write,
     .readdir = otf_readdir,
     .release = otf_release,
     .unlink = otf_unlink,
@@ -540,84 +1197,229 @@ static struct fuse_lowlevel_ops ops = {
 
 
 
-/* Called once for every file in the FS to fill in metadata not
-   specified by the user, either from FS for file-backed files, or
-   from algo specifics otherwise. */
+/* Open the config file. */
 
-static int otf_gatherFun(char *name, ino_t ino, void *foo) {
-    (void)foo; (void)name;
+static int otf_openConfig(void) {
+    if (options.config)
+        return open(options.config, O_RDONLY);
+    return openat(rootFh, "otffsrc", O_RDONLY);
+}
 
-    struct file *fp = AT(fs.files, ino);
-    assert(fp);
+/* Used by `otf_reload` to collect names the kernel must forget. */
 
-    if (fp->srcName) {
-        struct stat buf;
-        if (fstatat(rootFh, fp->srcName, &buf,
-                    AT_SYMLINK_NOFOLLOW))
-            err(1, "Cannot stat `%s`", fp->srcName);
+struct stale {
+    const char *name;
+    size_t ino;
+};
 
-        if ((buf.st_mode & S_IFMT) != S_IFREG)
-            errx(1, "Refusing to use non-regular file `%s` as source for `%s`.",
-                fp->srcName, name);
+struct staleList {
+    STACK(struct stale) list;
+};
 
-        if (fp->srcSize == uninitFile.srcSize) {
-            assert(buf.st_size >= 0);
-            fp->srcSize = (ssize_t)buf.st_size;
-        }
+static void otf_staleFun(const char *name, size_t ino, struct staleList *st) {
+    ENOUGH(st->list);
+    PUSH(st->list, ((struct stale){ .name = name, .ino = ino }));
+}
 
-        if (fp->size < 0)
-            fp->size = -(fp->size * fp->srcSize);
+/* Used by `otf_reload`: Whether the kernel still knows inode `ino`. */
 
-        if (fp->mode == uninitFile.mode)
-            fp->mode = buf.st_mode;
+static int otf_busyFun(size_t ino, struct staleList *st) {
+    (void)st;
+    return ino < lookups.used && AT(lookups, ino);
+}
 
-        if (fp->mtime == uninitFile.mtime)
-            fp->mtime = buf.st_mtime;
+/* Load the config again, and make it live.  Files defined as before
+   keep their inode, everything else is invalidated in the kernel, and
+   may reuse inode numbers the kernel has forgotten.  The parser
+   terminates on errors, so a child process tries it first, and a
+   broken config is rejected.  New files are gathered lazily. */
 
-        if (fp->atime == uninitFile.atime)
-            fp->atime = buf.st_atime;
+static void otf_reload(void) {
 
-    } else {
-        if (fp->size < 0) {
-            switch (fp->srcSize) {
-            case 0: // root directory
-                break;
-            case 1: // fill integers
-                fp->size = (ssize_t)((size_t)(-fp->size) *
-                                     sizeof(unsigned int) * (UINT_MAX + 1L));
-                break;
-            case 2: // fill chars
-                fp->size = (ssize_t)((size_t)(-fp->size) *
-                                     sizeof(unsigned char) * (UCHAR_MAX + 1L));
-                break;
-            default:
-                assert(0);
-                break;
-            }
+    /* Only this thread replaces `live`. */
+    if (live->fs.image) {
+        log("reload: %s", "not supported when serving an image");
+        return;
+    }
+
+    int fh = otf_openConfig();
+    if (fh < 0) {
+        log("reload: cannot open config: %s", strerror(errno));
+        return;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    ERRIF(pid < 0);
+    if (! pid) {
+        struct fileSystem check;
+        otffs_load(&check, rootFh, fh, 0, 0);
+        _exit(0);
+    }
+
+    int status;
+    ERRIF(waitpid(pid, &status, 0) != pid);
+    if (! WIFEXITED(status) || WEXITSTATUS(status)) {
+        log("reload: %s", "config rejected, keeping the old one");
+        close(fh);
+        return;
+    }
+    ERRIF(lseek(fh, 0, SEEK_SET) < 0);
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now))
+        now.tv_sec = 0;
+
+    struct snapshot *s = new(struct snapshot);
+    s->refs = 1;
+    otffs_load(&s->fs, rootFh, fh, now.tv_sec, 0);
+
+    struct staleList st;
+    ALLOCATE(st.list, 64);
+
+    /* Lookups must wait while adopting, as an inode number found free
+       must stay free until the new snapshot is live. */
+    ERRIF(pthread_rwlock_wrlock(&liveLock));
+    otffs_adopt(&s->fs, &live->fs,
+                (void (*)(const char *, size_t, void *))otf_staleFun,
+                (int (*)(size_t, void *))otf_busyFun, &st);
+    struct snapshot *old = live;
+    live = s;
+    otf_track();
+    ERRIF(pthread_rwlock_unlock(&liveLock));
+
+    /* Stale names point into `old`, which is still referenced. */
+    for (size_t i = 0; i < st.list.used; i++) {
+        const struct stale *x = &AT(st.list, i);
+        fuse_lowlevel_notify_inval_entry(session, FUSE_ROOT_ID, x->name,
+                                         strlen(x->name));
+        fuse_lowlevel_notify_inval_inode(session, x->ino, 0, 0);
+    }
+    fuse_lowlevel_notify_inval_inode(session, FUSE_ROOT_ID, 0, 0);
+
+    log("reload: serving %zu files, %zu changed or gone",
+        otffs_count(&s->fs), st.list.used);
+
+    free(st.list.array);
+    otf_unref(old);
+}
+
+/* Used by `otf_dump`.  Called once for every file in the FS. */
+
+struct dump_ctx {
+    struct fileSystem *fs;
+    int fd;
+};
+
+static int otf_dumpFun(char *name, ino_t ino, struct dump_ctx *ctx) {
+    struct file *fp = otffs_peek(ctx->fs, ino);
+    struct stats *st = fp ? __atomic_load_n(&fp->stats, __ATOMIC_ACQUIRE)
+        : NULL;
+    if (st)
+        stats_dump(st, ctx->fd, name, ino);
+    return 0;
+}
+
+/* Write the access statistics of all files opened so far to the file
+   given with `-o stats=FILE`, replacing its content, or to the log. */
+
+static void otf_dump(void) {
+
+    struct dump_ctx ctx = { .fs = NULL, .fd = logFh };
+    if (options.stats) {
+        ctx.fd = open(options.stats, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (ctx.fd < 0) {
+            log("stats: cannot open %s: %s", options.stats, strerror(errno));
+            return;
         }
+    }
+
+    ERRIF(pthread_rwlock_rdlock(&liveLock));
+    ctx.fs = &live->fs;
+    otffs_traverse(&live->fs, (avl_VisitorFun)otf_dumpFun, &ctx);
+    ERRIF(pthread_rwlock_unlock(&liveLock));
+
+    if (options.stats)
+        close(ctx.fd);
+}
 
-        if (fp->mode == uninitFile.mode)
-            fp->mode = S_IFREG | 0600;
 
-        if (fp->mtime == uninitFile.mtime)
-            fp->mtime = startupTime.tv_sec;
 
-        if (fp->atime == uninitFile.atime)
-            fp->atime = startupTime.tv_sec;
+/* SIGHUP requests a reload, SIGUSR1 a dump of statistics.  Both are
+   done by `otf_signalled`, outside of the signal handler. */
+
+static sem_t signalSem;
+static volatile sig_atomic_t hangup, dump;
+
+static void otf_signal(int sig) {
+    if (sig == SIGHUP)
+        hangup = 1;
+    else
+        dump = 1;
+    sem_post(&signalSem);
+}
+
+static void *otf_signalled(void *arg) {
+    (void)arg;
+    for (;;) {
+        if (sem_wait(&signalSem)) {
+            ERRIF(errno != EINTR);
+            continue;
+        }
+        if (hangup) {
+            hangup = 0;
+            otf_reload();
+        }
+        if (dump) {
+            dump = 0;
+            otf_dump();
+        }
     }
+    return NULL;
+}
+
+
+
+/* Implements `otffs --compile <config> -o <image>`: Parse the config,
+   and write it as an image to be served with `-o image`, see
+   `image.h`.  Sources are not looked at. */
+
+static int otf_compile(const char *config, const char *image) {
+
+    int fh = open(config, O_RDONLY);
+    if (fh < 0)
+        err(1, "Failed to open config file: %s", config);
+
+    struct fileSystem fs;
+    otffs_load(&fs, AT_FDCWD, fh, 0, 0);
+
+    int out = open(image, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        err(1, "Failed to create image: %s", image);
+    otffs_compile(&fs, out);
+    ERRIF(close(out));
+
+    printf("Compiled %zu files into %s\n", otffs_count(&fs) - 1, image);
+    otffs_free(&fs);
+    return 0;
+}
 
-    if (fp->nlink == uninitFile.nlink)
-        fp->nlink = 1;
 
-    if (fp->ctime == uninitFile.ctime)
-        fp->ctime = startupTime.tv_sec;
 
 #ifdef DEBUG //eJILSvajWpL4
 
-    /* Show a listing of all specified files. */
+/* Called once for every file in the FS to show a listing of all
+   specified files. */
+
+static int otf_listFun(char *name, ino_t ino, void *foo) {
+    (void)foo;
+
+    struct file *fp = otf_file(ino);
+    assert(fp);
 
+    time_t mtime = otffs_stamps(&live->fs, fp)->mtime;
     struct tm tmBuf;
-    localtime_r(&fp->mtime, &tmBuf);
+    localtime_r(&mtime, &tmBuf);
 
     const char *fmt[] = {
         "%b %d %H:%M",
@@ -625,7 +1427,7 @@ static int otf_gatherFun(char *name, ino_t ino, void *foo) {
     };
     char dateBuf[128];
     ERRIF(! strftime(dateBuf, 128, fmt[
-        startupTime.tv_sec - fp->mtime > 365 * 24 * 60 * 60
+        startupTime.tv_sec - mtime > 365 * 24 * 60 * 60
     ], &tmBuf));
 
     if (fp->srcName)
@@ -643,11 +1445,12 @@ static int otf_gatherFun(char *name, ino_t ino, void *foo) {
               name,
               fp->size,
               algorithms[fp->srcSize]);
-#endif //eJILSvajWpL4
 
     return 0;
 }
 
+#endif //eJILSvajWpL4
+
 
 
 /* Main function.  Really could do with some cleanup. */
@@ -663,6 +1466,9 @@ int main(int argc, char *argv[]) {
     logFh = 2;
 #endif //J2RTUVx5yO5P
 
+    if (argc == 5 && ! strcmp(argv[1], "--compile") && ! strcmp(argv[3], "-o"))
+        return otf_compile(argv[2], argv[4]);
+
     /* say hello */
 
     printf(
@@ -681,10 +1487,21 @@ int main(int argc, char *argv[]) {
     struct fuse_cmdline_opts opts;
     int ret = -1;
 
+    if (fuse_opt_parse(&args, &options, otf_opts, NULL) != 0)
+        return 1;
     if (fuse_parse_cmdline(&args, &opts) != 0)
         return 1;
     if (opts.show_help) {
         printf("usage: %s [options] <mountpoint>\n\n", argv[0]);
+        printf("otffs options:\n"
+               "    -o spill=FILE          keep data written to files in FILE\n"
+               "    -o config=FILE         use FILE instead of otffsrc\n"
+               "    -o image=FILE          serve an image from --compile\n"
+               "    -o lazy                gather metadata on first lookup\n"
+               "    -o gather=N            threads gathering metadata (8)\n"
+               "    -o trace=FILE          record requests in FILE\n"
+               "    -o stats=FILE          dump statistics to FILE on SIGUSR1\n"
+               "\n");
         fuse_cmdline_help();
         fuse_lowlevel_help();
         ret = 0;
@@ -709,47 +1526,48 @@ int main(int argc, char *argv[]) {
         err(1, "Failed to open mountpoint directory: %s", opts.mountpoint);
 
 
-    /* Prepare the global file system structure `fs`. */
-
-    /* AVL tree for looking up inode numbers by file name. */
-    fs.names = avl_new((avl_CmpFun)strcmp);
-
-    /* Inode to file mapping: A array. */
-    ALLOCATE(fs.files, min(FUSE_ROOT_ID + 1, 8));
-
-    { // Add root directory to filesystem
-        char *name = strdup(".");
-        ERRIF(! name);
-        ERRIF(avl_insert(fs.names, name, FUSE_ROOT_ID, NULL));
-
-        struct file *buf = new(struct file);
-        *buf = uninitFile;
-        buf->size = 0;
-        buf->srcSize = 0;
-        buf->mode = S_IFDIR | 0755;
-        buf->nlink = 2;
-        buf->atime = startupTime.tv_sec;
-        buf->mtime = startupTime.tv_sec;
-        buf->ctime = startupTime.tv_sec;
-
-        fs.files.array[FUSE_ROOT_ID] = buf;
-        fs.files.used = FUSE_ROOT_ID + 1;
+    if (options.spill) {
+        int fh = open(options.spill, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fh < 0)
+            err(1, "Failed to open spill file: %s", options.spill);
+        overlay_spill(fh);
     }
 
-    { /* Add more files from user config. */
-        int fh = openat(rootFh, "otffsrc", O_RDONLY);
+    if (options.trace) {
+        int fh = open(options.trace, O_WRONLY | O_CREAT | O_TRUNC, 0644);
         if (fh < 0)
-            err(1, "Failed to open config file: %s/otffsrc",
-                opts.mountpoint);
-        parse(&fs, fh);
-        close(fh);
+            err(1, "Failed to open trace file: %s", options.trace);
+        trace_start(fh);
     }
 
-    /* For all files in the config, gather missing information from
-       the filesystem. */
-    avl_traverse(fs.names, (avl_VisitorFun)otf_gatherFun, NULL);
+    { /* Prepare the live snapshot of the file system from the user
+         config. */
+        live = new(struct snapshot);
+        live->refs = 1;
+        if (options.image) {
+            int fh = open(options.image, O_RDONLY);
+            if (fh < 0)
+                err(1, "Failed to open image: %s", options.image);
+            otffs_map(&live->fs, rootFh, fh, startupTime.tv_sec);
+            close(fh);
+        } else {
+            int fh = otf_openConfig();
+            if (fh < 0)
+                err(1, "Failed to open config file: %s",
+                    options.config ? options.config : "otffsrc");
+            otffs_load(&live->fs, rootFh, fh, startupTime.tv_sec,
+                       options.lazy ? 0 : max(options.gather, 1));
+        }
+    }
+
+    ALLOCATE(lookups, 64);
+    otf_track();
+
+#ifdef DEBUG //eJILSvajWpL4
+    otffs_traverse(&live->fs, (avl_VisitorFun)otf_listFun, NULL);
+#endif //eJILSvajWpL4
 
-    log("Serving %ld files...", avl_size(fs.names));
+    log("Serving %ld files...", otffs_count(&live->fs));
 
     /* BEGIN Code copied from libfuse docs */
     se = fuse_session_new(&args, &ops, sizeof(ops), NULL);
@@ -763,6 +1581,24 @@ int main(int argc, char *argv[]) {
     if (fuse_session_mount(se, opts.mountpoint) != 0)
         goto err_out3;
 
+    /* Sends replies deferred by `otf_useProfile`. */
+    wheel_start();
+
+    /* Reload the config on SIGHUP, instead of terminating as set up by
+       `fuse_set_signal_handlers`.  Dump statistics on SIGUSR1. */
+    session = se;
+    {
+        ERRIF(sem_init(&signalSem, 0, 0));
+        pthread_t tid;
+        ERRIF(pthread_create(&tid, NULL, otf_signalled, NULL));
+        ERRIF(pthread_detach(tid));
+
+        struct sigaction sa = { .sa_handler = otf_signal };
+        ERRIF(sigemptyset(&sa.sa_mask));
+        ERRIF(sigaction(SIGHUP, &sa, NULL));
+        ERRIF(sigaction(SIGUSR1, &sa, NULL));
+    }
+
     //    fuse_daemonize(opts.foreground);
 
     /* Block until ctrl+c or fusermount3 -u */
@@ -771,7 +1607,10 @@ int main(int argc, char *argv[]) {
     else
         ret = fuse_session_loop_mt(se, opts.clone_fd);
 
+    /* Send the replies still deferred, before the session goes. */
+    wheel_stop();
     fuse_session_unmount(se);
+    trace_stop();
  err_out3:
     fuse_remove_signal_handlers(se);
  err_out2:
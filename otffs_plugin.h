@@ -0,0 +1,55 @@
+/* The interface of producer plugins, shared objects that produce the
+   content of files for otffs, `otffs-cat` and `libotffs`.  A file is
+   produced by a plugin with
+
+       name : fill plugin "path/to/plugin.so", args "anything"
+
+   The path is passed to dlopen(3) as is, so a name without `/` is
+   searched for like any library.  The plugin defines the symbol
+   `otffs_producer`, of the type below, with `abi` set to
+   `OTFFS_PLUGIN_ABI`.  Plugins of another ABI version are rejected.
+
+   Every file produced by a plugin has its own context, made by `open`
+   from the args of the file, when the config is loaded.  `fill` is
+   called by many threads at once, with the same context, and must not
+   fail.  Plugins do not need to link against anything of otffs. */
+
+#ifndef otffs_plugin_Nw6cQx3TzHb8
+#define otffs_plugin_Nw6cQx3TzHb8
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define OTFFS_PLUGIN_ABI 1
+
+struct otffs_producer {
+    uint32_t abi; // OTFFS_PLUGIN_ABI
+
+    /* Return a new context for `args`, the empty string if not given.
+       On failure, return `NULL`, and set `errno`. */
+    void *(*open)(const char *args);
+
+    /* Free `ctx`. */
+    void (*close)(void *ctx);
+
+    /* Return the natural size of the content, used when the config
+       gives no size, and as the unit of the size suffix `x`.  Must not
+       be 0. */
+    uint64_t (*size)(void *ctx);
+
+    /* Optional, may be `NULL`, or return `NULL`: If the content is a
+       repetition of `*len` bytes, return them.  They must stay valid
+       until `close`.  Reads are then replied directly from that
+       buffer, without calling `fill`. */
+    const void *(*tile)(void *ctx, size_t *len);
+
+    /* Store the `len` bytes of content at offset `off` in the buffers
+       of `iov`, in order.  Their lengths add up to `len`. */
+    void (*fill)(void *ctx, uint64_t off, size_t len,
+                 const struct iovec *iov, int iovcnt);
+};
+
+extern const struct otffs_producer otffs_producer;
+
+#endif
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include "avl_tree.h"
+#include "common.h"
+#include "overlay.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* See `overlay.h` for documentation.
+
+   The extents are kept in an AVL tree, keyed by a pointer to the
+   extent itself.  Its first member is the offset, which is all the
+   comparison function looks at.  So a pointer to a plain `size_t` can
+   be used to look up extents. */
+
+
+
+struct extent {
+    size_t off, len; // range of the file covered
+    size_t cap; // allocated size of `data`
+    char *data; // the bytes written, NULL if spilled
+    off_t spill; // position in spill file, if spilled
+};
+
+struct overlay {
+    pthread_rwlock_t lock;
+    avl_Tree extents;
+    size_t refs; // see `overlay_share`
+};
+
+static int spillFh = -1; // see `overlay_spill`
+static off_t spillEnd = 0; // size of spill file, atomically incremented
+
+#define end(e) ((e)->off + (e)->len)
+
+
+
+static int cmpFun(const size_t *x, const size_t *y) {
+    return (*x > *y) - (*x < *y);
+}
+
+/* Return the extent with the greatest offset <= `off`, or NULL. */
+
+static struct extent *floorExtent(struct overlay *o, size_t off) {
+    avl_Key k;
+    return avl_lookupLE(o->extents, &off, &k, NULL)
+        ? (struct extent *)k : NULL;
+}
+
+static void insertExtent(struct overlay *o, struct extent *e) {
+    ERRIF(avl_insert(o->extents, e, 0, NULL));
+}
+
+static void deleteExtent(struct overlay *o, struct extent *e) {
+    ERRIF(! avl_deleteWith(NULL, o->extents, e, NULL));
+    free(e->data);
+    free(e);
+}
+
+
+
+/* Write `len` bytes from `buf` at position `pos` of extent `e`. */
+
+static void putData(struct extent *e, size_t pos, size_t len,
+                    const char *buf) {
+    if (e->data)
+        memcpy(e->data + pos, buf, len);
+    else
+        ERRIF(pwrite(spillFh, buf, len, e->spill + (off_t)pos)
+              != (ssize_t)len);
+}
+
+/* Create an extent for [off, off+len), holding `len` bytes from
+   `buf`. */
+
+static struct extent *newExtent(size_t off, size_t len, const char *buf) {
+    struct extent *e = new(struct extent);
+    *e = (struct extent){ .off = off, .len = len, .cap = len };
+    if (spillFh < 0) {
+        e->data = malloc(max(len, 1));
+        ERRIF(! e->data);
+    } else {
+        e->spill = __atomic_fetch_add(&spillEnd, (off_t)len, __ATOMIC_RELAXED);
+    }
+    putData(e, 0, len, buf);
+    return e;
+}
+
+/* Try to append `len` bytes from `buf` to extent `e`.  Returns 0 if
+   not possible without moving spilled data. */
+
+static int appendExtent(struct extent *e, size_t len, const char *buf) {
+    if (e->data) {
+        if (e->len + len > e->cap) {
+            e->cap = max(2 * e->cap, e->len + len);
+            e->data = realloc(e->data, e->cap);
+            ERRIF(! e->data);
+        }
+    } else {
+        /* Only possible if nothing was spilled after `e`. */
+        off_t expect = e->spill + (off_t)e->len;
+        if (! __atomic_compare_exchange_n(&spillEnd, &expect,
+                                          expect + (off_t)len, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 0;
+    }
+    putData(e, e->len, len, buf);
+    e->len += len;
+    return 1;
+}
+
+/* Remove the bytes at and beyond `pos` from extent `e`. */
+
+static void trimExtent(struct extent *e, size_t pos) {
+    e->len = pos;
+}
+
+/* Return a new extent with the bytes of `e` at and beyond `pos`,
+   offset in the file accordingly. */
+
+static struct extent *tailExtent(struct extent *e, size_t pos) {
+    if (e->data)
+        return newExtent(e->off + pos, e->len - pos, e->data + pos);
+
+    struct extent *t = new(struct extent);
+    *t = (struct extent){
+        .off = e->off + pos,
+        .len = e->len - pos,
+        .spill = e->spill + (off_t)pos,
+    };
+    return t;
+}
+
+
+
+void overlay_spill(int fd) {
+    spillFh = fd;
+    spillEnd = lseek(fd, 0, SEEK_END);
+    ERRIF(spillEnd < 0);
+}
+
+
+
+struct overlay *overlay_new(void) {
+    struct overlay *o = new(struct overlay);
+    ERRIF(pthread_rwlock_init(&o->lock, NULL));
+    o->extents = avl_new((avl_CmpFun)cmpFun);
+    ERRIF(! o->extents);
+    o->refs = 1;
+    return o;
+}
+
+
+
+struct overlay *overlay_share(struct overlay *o) {
+    __atomic_add_fetch(&o->refs, 1, __ATOMIC_RELAXED);
+    return o;
+}
+
+
+
+static int freeFun(struct extent *e, avl_Val v, avl_State s) {
+    (void)v; (void)s;
+    free(e->data);
+    free(e);
+    return 0;
+}
+
+void overlay_free(struct overlay *o) {
+    if (__atomic_sub_fetch(&o->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    avl_free(o->extents, (avl_VisitorFun)freeFun, NULL);
+    ERRIF(pthread_rwlock_destroy(&o->lock));
+    free(o);
+}
+
+
+
+void overlay_write(struct overlay *o, size_t off, size_t len,
+                   const char *buf, ssize_t *size) {
+    if (! len)
+        return;
+
+    const size_t e0 = off + len;
+    struct extent *e;
+
+    ERRIF(pthread_rwlock_wrlock(&o->lock));
+
+    /* Overwriting data inside one extent is done in place. */
+    e = floorExtent(o, off);
+    if (e && e0 <= end(e)) {
+        putData(e, off - e->off, len, buf);
+        goto out;
+    }
+
+    /* Remove all data written in [off, e0) before, scanning down from
+       the end.  Partly overlapping extents are cut. */
+    while ((e = floorExtent(o, e0 - 1)) && end(e) > off) {
+        if (end(e) > e0) {
+            insertExtent(o, tailExtent(e, e0 - e->off));
+            trimExtent(e, e0 - e->off);
+        }
+        if (e->off < off) {
+            trimExtent(e, off - e->off);
+            break;
+        }
+        deleteExtent(o, e);
+    }
+
+    /* Append to an adjacent extent, to keep sequential writes in one
+       extent.  Otherwise, start a new one. */
+    e = off ? floorExtent(o, off - 1) : NULL;
+    if (! (e && end(e) == off && appendExtent(e, len, buf)))
+        insertExtent(o, newExtent(off, len, buf));
+
+ out:
+    /* Readers of the size take no lock, but must not see torn values. */
+    if (size && __atomic_load_n(size, __ATOMIC_RELAXED) < (ssize_t)e0)
+        __atomic_store_n(size, (ssize_t)e0, __ATOMIC_RELAXED);
+    ERRIF(pthread_rwlock_unlock(&o->lock));
+}
+
+
+
+void overlay_truncate(struct overlay *o, size_t length, ssize_t *size) {
+    struct extent *e;
+
+    ERRIF(pthread_rwlock_wrlock(&o->lock));
+
+    while ((e = floorExtent(o, SIZE_MAX)) && end(e) > length) {
+        if (e->off < length) {
+            trimExtent(e, length - e->off);
+            break;
+        }
+        deleteExtent(o, e);
+    }
+    if (size)
+        __atomic_store_n(size, (ssize_t)length, __ATOMIC_RELAXED);
+
+    ERRIF(pthread_rwlock_unlock(&o->lock));
+}
+
+
+
+size_t overlay_acquire(struct overlay *o, size_t off, size_t len,
+                       struct overlay_piece **pieces) {
+
+    const size_t e0 = off + len;
+
+    ERRIF(pthread_rwlock_rdlock(&o->lock));
+
+    /* Collect overlapping extents, scanning down from the end. */
+    STACK(struct extent *) found;
+    ALLOCATE(found, 8);
+    for (struct extent *e = len ? floorExtent(o, e0 - 1) : NULL;
+         e && end(e) > off;
+         e = e->off ? floorExtent(o, e->off - 1) : NULL) {
+        ENOUGH(found);
+        PUSH(found, e);
+    }
+
+    /* Worst case: holes around and between all extents. */
+    struct overlay_piece *p = calloc(2 * found.used + 1, sizeof(*p));
+    ERRIF(! p);
+
+    size_t n = 0, pos = off;
+    while (found.used) {
+        struct extent *e = POP(found);
+        size_t s = max(e->off, off), t = min(end(e), e0);
+
+        if (pos < s)
+            p[n++] = (struct overlay_piece){ .off = pos, .len = s - pos };
+
+        p[n] = (struct overlay_piece){ .off = s, .len = t - s };
+        if (e->data) {
+            p[n].data = e->data + (s - e->off);
+        } else {
+            char *buf = malloc(t - s);
+            ERRIF(! buf);
+            ERRIF(pread(spillFh, buf, t - s, e->spill + (off_t)(s - e->off))
+                  != (ssize_t)(t - s));
+            p[n].data = buf;
+            p[n].owned = 1;
+        }
+        n++;
+        pos = t;
+    }
+    if (pos < e0)
+        p[n++] = (struct overlay_piece){ .off = pos, .len = e0 - pos };
+
+    free(found.array);
+
+    *pieces = p;
+    return n;
+}
+
+
+
+void overlay_release(struct overlay *o, struct overlay_piece *pieces,
+                     size_t n) {
+    for (size_t i = 0; i < n; i++)
+        if (pieces[i].owned)
+            free((char *)pieces[i].data);
+    free(pieces);
+
+    ERRIF(pthread_rwlock_unlock(&o->lock));
+}
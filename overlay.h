@@ -0,0 +1,67 @@
+/* Copy-on-write overlay for writable files.  Data written to a file is
+   kept as a set of non-overlapping extents, layered over the content
+   generated for the file.  Memory is proportional to the number of
+   bytes written, not to the size of the file.
+
+   All functions may be called concurrently on the same overlay. */
+
+#ifndef overlay_Zk4pQe7mRsTa
+#define overlay_Zk4pQe7mRsTa
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct overlay;
+
+/* One piece of a range read from an overlay: Either written data, or
+   a hole (`data == NULL`) to be filled with generated content. */
+
+struct overlay_piece {
+    size_t off, len;
+    const char *data;
+    int owned; // private: `data` was allocated for this piece
+};
+
+/* Keep written data in the file `fd` instead of memory.  Must be called
+   before any data is written, and applies to all overlays. */
+
+void overlay_spill(int fd);
+
+/* Return a new, empty overlay.  Terminates the program on failure. */
+
+struct overlay *overlay_new(void);
+
+/* Return `o`, to be used by one more file.  Each user must call
+   `overlay_free` eventually. */
+
+struct overlay *overlay_share(struct overlay *o);
+
+/* Free the overlay and all data written to it, unless it is still
+   shared with other users. */
+
+void overlay_free(struct overlay *o);
+
+/* Store `len` bytes from `buf` at offset `off`, replacing any data
+   written there before.  Unless `size` is `NULL`, raise the file size
+   `*size` to the end of the data, if smaller, while the overlay is
+   locked, so it is consistent with concurrent writes and truncates. */
+
+void overlay_write(struct overlay *o, size_t off, size_t len, const char *buf,
+                   ssize_t *size);
+
+/* Forget all data written beyond `length`, and set the file size
+   `*size` to it, unless `size` is `NULL`. */
+
+void overlay_truncate(struct overlay *o, size_t length, ssize_t *size);
+
+/* Describe the range [off, off+len) as a sequence of pieces, stored in
+   `*pieces`, and return their number.  The pieces are valid, and the
+   overlay is locked against modification, until `overlay_release` is
+   called. */
+
+size_t overlay_acquire(struct overlay *o, size_t off, size_t len,
+                       struct overlay_piece **pieces);
+
+void overlay_release(struct overlay *o, struct overlay_piece *pieces, size_t n);
+
+#endif
@@ -1,9 +1,14 @@
 #define _GNU_SOURCE
 
+#include "arena.h"
 #include "common.h"
+#include "overlay.h"
 #include "parser.h"
-#include <assert.h>
+#include "plugin.h"
+#include "profile.h"
+#include "record.h"
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
@@ -11,7 +16,7 @@
 #include <unistd.h>
 
 #define MAX_NAME_LENGTH 128
-#define READ_BUF_SIZE (1<<10)
+#define READ_BUF_SIZE (1<<16)
 
 
 
@@ -28,6 +33,13 @@ struct {
     { "x", -1 },
 };
 
+struct {
+    const char *s;
+    long f;
+} durSuf[] = {
+    { "ns", 1 }, { "us", 1000 }, { "ms", 1000000 }, { "s", 1000000000 },
+};
+
 
 static size_t addFun(char *k, size_t v, size_t o) {
     (void)v; (void)o;
@@ -35,22 +47,465 @@ static size_t addFun(char *k, size_t v, size_t o) {
     return 0;
 }
 
+/* Parse a size with optional suffix from `str` into `*size`.  Factors
+   of the source (`x`) result in a negative value.  Returns 0 on
+   success. */
+
+static int parseSize(const char *str, ssize_t *size) {
+    char *e;
+    long int x = strtol(str, &e, 10);
+    if (x < 0 || x == LONG_MAX)
+        return -1;
+    *size = (ssize_t)x;
+    if (*e) {
+        off_t f = 0;
+        for (size_t s = 0; s < sizeof(suf)/sizeof(*suf); s++) {
+            if (!strcmp(suf[s].s, e)) {
+                f = suf[s].f;
+                break;
+            }
+        }
+        if (!f)
+            return -1;
+        *size *= f;
+    }
+    return 0;
+}
+
+/* Parse a duration with mandatory suffix from `str`, return it in ns.
+   Returns -1 if invalid. */
+
+static long parseDuration(const char *str) {
+    char *e;
+    long int x = strtol(str, &e, 10);
+    if (x < 0 || x == LONG_MAX)
+        return -1;
+    for (size_t s = 0; s < sizeof(durSuf)/sizeof(*durSuf); s++)
+        if (!strcmp(durSuf[s].s, e))
+            return x * durSuf[s].f;
+    return -1;
+}
+
+/* Return the profile of `fp`, creating it if necessary. */
+
+static struct profile *profile(struct file *fp) {
+    if (!fp->profile)
+        fp->profile = profile_new();
+    return fp->profile;
+}
+
+/* Tokens, as produced by the tokenizer.  The string of a plain or
+   quoted token is pending in the arena of the file system, and must be
+   kept explicitly to survive the next token. */
+
+struct token {
+    enum type { tPlain, tQuoted, tColon, tComma, tNewline } ty;
+    char *str;
+    size_t lin, col;
+};
+
+/* State of the parser between tokens. */
+
+struct parser {
+    enum {
+        pName, pColon, pNext, pKey, pPass, pSize, pMode, pMtime, pFill,
+        pRate, pLatency, pJitter, pStall, pEvery, pSeed, pBlock, pRatio,
+        pUnique, pDist, pFields,
+        pStart, pStride, pOffset, pWidth, pEndian, pPlugin, pArgs
+    } state;
+    struct fileSystem *fs;
+    struct file *current;
+    struct stamps stamps; // of `current`
+    char *name;
+};
+
+/* Keywords, and the state they lead to.  `writable` takes no
+   argument, and is handled separately. */
+
+struct {
+    const char *s;
+    int state;
+} keywords[] = {
+    { "pass", pPass }, { "fill", pFill }, { "size", pSize },
+    { "mode", pMode }, { "mtime", pMtime }, { "rate", pRate },
+    { "latency", pLatency }, { "jitter", pJitter }, { "stall", pStall },
+    { "every", pEvery }, { "seed", pSeed }, { "block", pBlock },
+    { "ratio", pRatio }, { "unique", pUnique }, { "dist", pDist },
+    { "fields", pFields }, { "start", pStart }, { "stride", pStride },
+    { "offset", pOffset }, { "width", pWidth }, { "endian", pEndian },
+    { "args", pArgs },
+};
+
+/* Load the plugin of the current file, see `plugin.h`.  Done once the
+   definition is complete, as `args` may come after `fill`. */
+
+static void load(struct parser *p) {
+    const char *why;
+    p->current->plugin = plugin_open(p->current->param.library,
+                                     p->current->param.args, &why);
+    if (! p->current->plugin)
+        errx(1, "Cannot load plugin `%s` of `%s`: %s",
+             p->current->param.library, p->name, why);
+}
+
+/* Feed one token to the parser. */
+
+static void step(struct parser *p, struct token *tk) {
+
+    switch (p->state) {
+
+    case pName:
+        switch (tk->ty) {
+        case tPlain:
+        case tQuoted:
+            p->name = arena_keep(&p->fs->strings);
+            p->state = pColon;
+            break;
+        case tNewline:
+            break;
+        default:
+            errx(1, "Expected file name before %ld:%ld", tk->lin, tk->col);
+            break;
+        }
+        break;
+
+    case pColon:
+        if (tk->ty == tColon) {
+            p->state = pKey;
+            break;
+        }
+        errx(1, "Expected `:` before %ld:%ld", tk->lin, tk->col);
+        break;
+
+    case pNext:
+        switch (tk->ty) {
+        case tComma:
+            p->state = pKey;
+            break;
+        case tNewline:
+            if (! p->current->srcName && p->current->srcSize == algoPlugin)
+                load(p);
+            avl_insertWith((avl_AddFun)addFun, p->fs->names, p->name,
+                           p->fs->files.used, NULL);
+            ENOUGH(p->fs->files);
+            ENOUGH(p->fs->stamps);
+            p->current->ino = p->fs->files.used;
+            PUSH(p->fs->files, p->current);
+            PUSH(p->fs->stamps, p->stamps);
+            p->current = new(struct file);
+            *p->current = uninitFile;
+            p->stamps = uninitStamps;
+            p->state = pName;
+            break;
+        default:
+            errx(1, "Expected `,` or newline before %ld:%ld", tk->lin, tk->col);
+        }
+        break;
+
+    case pKey:
+        if (tk->ty != tPlain) {
+            errx(1, "Expected keyword before %ld:%ld", tk->lin, tk->col);
+            break;
+        }
+        for (size_t k = 0; k < sizeof(keywords)/sizeof(*keywords); k++) {
+            if (!strcmp(keywords[k].s, tk->str)) {
+                p->state = keywords[k].state;
+                return;
+            }
+        }
+        if (!strcmp("writable", tk->str)) {
+            if (!p->current->overlay)
+                p->current->overlay = overlay_new();
+            p->state = pNext;
+            break;
+        }
+        errx(1, "Unexpected key `%s` before %ld:%ld when defining `%s`",
+             tk->str, tk->lin, tk->col, p->name);
+        break;
+
+    case pFill: {
+        unsigned int found = 0;
+        for (unsigned int i = 1; tk->str && algorithms[i]; i++) {
+            if (!strcmp(algorithms[i], tk->str)) {
+                found = i;
+                break;
+            }
+        }
+        if (found) {
+            p->current->srcName = NULL;
+            p->current->srcSize = found;
+            p->state = found == algoPlugin ? pPlugin : pNext;
+            break;
+        }
+        errx(1, "Unexpected fill mode `%s` before %ld:%ld",
+             tk->str ? tk->str : "", tk->lin, tk->col);
+        break;
+    }
+
+    case pPass:
+        switch (tk->ty) {
+        case tPlain:
+        case tQuoted:
+            p->current->srcName = arena_keep(&p->fs->strings);
+            p->state = pNext;
+            break;
+        case tComma:
+        case tNewline:
+            p->current->srcName = p->name;
+            p->state = pNext;
+            step(p, tk);
+            break;
+        default:
+            errx(1, "Expected source name before %ld:%ld", tk->lin, tk->col);
+            break;
+        }
+        break;
+
+    case pSize:
+        switch (tk->ty) {
+        case tPlain:
+            if (parseSize(tk->str, &p->current->size))
+                errx(1, "Invalid size before %ld:%ld", tk->lin, tk->col);
+            p->state = pNext;
+            break;
+        default:
+            errx(1, "Expected file size before %ld:%ld", tk->lin, tk->col);
+            break;
+        }
+        break;
+
+    case pRate:
+    case pEvery: {
+        ssize_t x;
+        if (tk->ty != tPlain || parseSize(tk->str, &x) || x < 0)
+            errx(1, "Expected size before %ld:%ld", tk->lin, tk->col);
+        if (p->state == pRate)
+            profile(p->current)->rate = (size_t)x;
+        else
+            profile(p->current)->every = (size_t)x;
+        p->state = pNext;
+        break;
+    }
+
+    case pSeed:
+    case pStart:
+    case pStride: {
+        char *e;
+        if (tk->ty != tPlain || ! isdigit(*tk->str))
+            errx(1, "Expected number before %ld:%ld", tk->lin, tk->col);
+        errno = 0;
+        uint64_t x = strtoull(tk->str, &e, 10);
+        if (*e || errno)
+            errx(1, "Invalid number `%s` before %ld:%ld",
+                 tk->str, tk->lin, tk->col);
+        if (p->state == pSeed)
+            p->current->param.seed = x;
+        else if (p->state == pStart)
+            p->current->param.start = x;
+        else
+            p->current->param.stride = x;
+        p->state = pNext;
+        break;
+    }
+
+    case pOffset: {
+        ssize_t x;
+        if (tk->ty != tPlain || parseSize(tk->str, &x) || x < 0)
+            errx(1, "Expected offset before %ld:%ld", tk->lin, tk->col);
+        p->current->param.offset = (size_t)x;
+        p->state = pNext;
+        break;
+    }
+
+    case pWidth: {
+        char *e = NULL;
+        unsigned long x = tk->ty == tPlain ? strtoul(tk->str, &e, 10) : 0;
+        if (! e || *e || (x != 8 && x != 16 && x != 32 && x != 64))
+            errx(1, "Expected width of 8, 16, 32 or 64 before %ld:%ld",
+                 tk->lin, tk->col);
+        p->current->param.width = (unsigned int)x;
+        p->state = pNext;
+        break;
+    }
+
+    case pEndian:
+        if (tk->ty == tPlain && ! strcmp(tk->str, "little"))
+            p->current->param.bigEndian = 0;
+        else if (tk->ty == tPlain && ! strcmp(tk->str, "big"))
+            p->current->param.bigEndian = 1;
+        else
+            errx(1, "Expected `little` or `big` before %ld:%ld",
+                 tk->lin, tk->col);
+        p->state = pNext;
+        break;
+
+    case pBlock: {
+        ssize_t x;
+        if (tk->ty != tPlain || parseSize(tk->str, &x) || x <= 0 || x % 8)
+            errx(1, "Expected block size, a multiple of 8, before %ld:%ld",
+                 tk->lin, tk->col);
+        p->current->param.block = (size_t)x;
+        p->state = pNext;
+        break;
+    }
+
+    case pRatio: {
+        char *e = NULL;
+        double x = tk->ty == tPlain ? strtod(tk->str, &e) : 0;
+        if (! e || *e || ! (x >= 1 && x <= 1e9))
+            errx(1, "Expected ratio of at least 1 before %ld:%ld",
+                 tk->lin, tk->col);
+        p->current->param.ratio = x;
+        p->state = pNext;
+        break;
+    }
+
+    case pUnique: {
+        ssize_t x;
+        if (tk->ty != tPlain || parseSize(tk->str, &x) || x <= 0)
+            errx(1, "Expected number of blocks before %ld:%ld",
+                 tk->lin, tk->col);
+        p->current->param.unique = (size_t)x;
+        p->state = pNext;
+        break;
+    }
+
+    case pDist: {
+        double s = 0;
+        int n = 0;
+        if (tk->ty == tPlain && ! strcmp(tk->str, "uniform"))
+            p->current->param.skew = 0;
+        else if (tk->ty == tPlain && sscanf(tk->str, "zipf(%lf)%n", &s, &n)
+                 && ! tk->str[n] && n && s > 0 && s <= 100)
+            p->current->param.skew = s;
+        else
+            errx(1, "Expected `uniform` or `zipf(s)`, s > 0, before %ld:%ld",
+                 tk->lin, tk->col);
+        p->state = pNext;
+        break;
+    }
+
+    case pFields: {
+        struct record r;
+        if ((tk->ty != tPlain && tk->ty != tQuoted)
+            || record_parse(tk->str, 1, &r))
+            errx(1, "Expected fields like \"id:id user:str(8)\" before "
+                 "%ld:%ld, see `record.h`", tk->lin, tk->col);
+        p->current->param.fields = arena_keep(&p->fs->strings);
+        p->state = pNext;
+        break;
+    }
+
+    case pPlugin:
+    case pArgs:
+        if (tk->ty != tPlain && tk->ty != tQuoted)
+            errx(1, "Expected %s before %ld:%ld",
+                 p->state == pPlugin ? "path of plugin" : "plugin args",
+                 tk->lin, tk->col);
+        if (p->state == pPlugin)
+            p->current->param.library = arena_keep(&p->fs->strings);
+        else
+            p->current->param.args = arena_keep(&p->fs->strings);
+        p->state = pNext;
+        break;
+
+    case pLatency:
+    case pJitter:
+    case pStall: {
+        long x = tk->ty == tPlain ? parseDuration(tk->str) : -1;
+        if (x < 0)
+            errx(1, "Expected duration like `2ms` before %ld:%ld",
+                 tk->lin, tk->col);
+        if (p->state == pLatency)
+            profile(p->current)->latency = x;
+        else if (p->state == pJitter)
+            profile(p->current)->jitter = x;
+        else
+            profile(p->current)->stall = x;
+        p->state = pNext;
+        break;
+    }
+
+    case pMtime:
+        switch (tk->ty) {
+        case tPlain:
+            {
+                char *e;
+                long int x = strtol(tk->str, &e, 10);
+                if (x < 0 || x == LONG_MAX || *e)
+                    errx(1, "Invalid unix time `%s` before %ld:%ld",
+                         tk->str, tk->lin, tk->col);
+                p->stamps.mtime = x;
+                p->state = pNext;
+            }
+            break;
+        default:
+            errx(1, "Expected file time before %ld:%ld", tk->lin, tk->col);
+            break;
+        }
+        break;
+
+    case pMode:
+        switch (tk->ty) {
+        case tPlain:
+            {
+                char *e;
+                long int x = strtol(tk->str, &e, 8);
+                if (x < 0 || 0777 < x || *e)
+                    errx(1, "Invalid file mode `%s` before %ld:%ld",
+                         tk->str, tk->lin, tk->col);
+                p->current->mode = S_IFREG | (mode_t)(x & 0777);
+                p->state = pNext;
+            }
+            break;
+        default:
+            errx(1, "Expected file mode before %ld:%ld", tk->lin, tk->col);
+            break;
+        }
+        break;
+
+    }
+}
+
+/* Feed one token to the parser, and add it to the fingerprint of the
+   definition of the current file, using FNV-1a.  Used to recognise
+   unchanged definitions when reloading the config. */
+
+static void feed(struct parser *p, struct token *tk) {
+
+    if (p->state != pName && p->state != pColon && tk->ty != tNewline) {
+        const uint64_t prime = 0x100000001b3;
+        uint64_t h = (p->current->def ^ tk->ty) * prime;
+        for (const char *c = tk->str; c && *c; c++)
+            h = (h ^ (unsigned char)*c) * prime;
+        p->current->def = h;
+    }
+
+    step(p, tk);
+}
+
+/* Tokenize and parse in a single pass over the config.  Strings are
+   collected in the arena of the file system, and only names of files
+   and sources are kept there, so memory grows with the total length
+   of names only. */
+
 int parse(struct fileSystem *pr, int fd) {
 
     ssize_t n;
     char read_buf[READ_BUF_SIZE];
 
-    STACK(char) buf;
-    ALLOCATE(buf, 32);
+    struct arena *a = &pr->strings;
 
-    struct token {
-        enum type { tPlain, tQuoted, tColon, tComma, tNewline } ty;
-        char *str;
-        size_t lin, col;
+    struct parser p = {
+        .state = pName,
+        .fs = pr,
+        .current = new(struct file),
+        .stamps = uninitStamps,
+        .name = NULL,
     };
+    *p.current = uninitFile;
 
-    STACK(struct token) tok;
-    ALLOCATE(tok, 32);
+    struct token tk;
 
     enum { sSpace, sPlain, sQuoted, sComment } state = sSpace;
 
@@ -78,13 +533,14 @@ int parse(struct fileSystem *pr, int fd) {
                     state = sPlain; // do parsing later: octal? decimal?
                     break;
                 }
-                ENOUGH(tok);
                 switch (c) {
                 case ':':
-                    PUSH(tok, ((struct token){ tColon, 0, lin, col }));
+                    tk = (struct token){ tColon, 0, lin, col };
+                    feed(&p, &tk);
                     break;
                 case ',':
-                    PUSH(tok, ((struct token){ tComma, 0, lin, col }));
+                    tk = (struct token){ tComma, 0, lin, col };
+                    feed(&p, &tk);
                     break;
                 case '"':
                     state = sQuoted;
@@ -95,7 +551,8 @@ int parse(struct fileSystem *pr, int fd) {
                 case '\n':
                     lin++;
                     col = 0;
-                    PUSH(tok, ((struct token){ tNewline, 0, lin, col }));
+                    tk = (struct token){ tNewline, 0, lin, col };
+                    feed(&p, &tk);
                     break;
                 default: errx(1, "Unexpected `%c` before %ld:%ld", c, lin, col);
                 }
@@ -110,27 +567,23 @@ int parse(struct fileSystem *pr, int fd) {
                 break;
 
             case sPlain:
-                if (isalnum(c)) {
-                    PUSH(buf, c);
+                if (isalnum(c) || (c && strchr(".()", c))) { // for `zipf(1.5)`
+                    arena_add(a, c);
                     break;
                 }
                 i--;
                 col--;
-                PUSH(buf, '\0');
-                TRIM(buf);
-                ENOUGH(tok);
-                PUSH(tok, ((struct token){ tPlain, buf.array, lin, col }));
-                ALLOCATE(buf, 32);
+                tk = (struct token){ tPlain, arena_str(a), lin, col };
+                feed(&p, &tk);
+                arena_drop(a);
                 state = sSpace;
                 break;
 
             case sQuoted:
                 if (c == '"') {
-                    PUSH(buf, '\0');
-                    TRIM(buf);
-                    ENOUGH(tok);
-                    PUSH(tok, ((struct token){ tQuoted, buf.array, lin, col }));
-                    ALLOCATE(buf, 32);
+                    tk = (struct token){ tQuoted, arena_str(a), lin, col };
+                    feed(&p, &tk);
+                    arena_drop(a);
                     state = sSpace;
                     break;
                 }
@@ -138,221 +591,33 @@ int parse(struct fileSystem *pr, int fd) {
                     lin++;
                     col=0;
                 }
-                PUSH(buf, c);
+                arena_add(a, c);
                 break;
 
             } // switch (state)
-
-            ENOUGH(buf);
         }
     }
 
-    free(buf.array);
+    ERRIF(n < 0);
     close(fd);
 
-
-    enum {
-        pName, pColon, pNext, pKey, pPass, pSize, pMode, pMtime, pFill
-    } pState = pName;
-
-    struct file *current = new(struct file);
-    *current = uninitFile;
-    char *name = NULL;
-
-    for (size_t t = 0; t < tok.used; t++) {
-        switch (pState) {
-
-        case pName:
-            switch (AT(tok,t).ty) {
-            case tPlain:
-            case tQuoted:
-                name = AT(tok,t).str;
-                assert(name);
-                pState = pColon;
-                break;
-            case tNewline:
-                break;
-            default:
-                errx(1, "Expected file name before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-                break;
-            }
-            break;
-
-        case pColon:
-            if (AT(tok,t).ty == tColon) {
-                pState = pKey;
-                break;
-            }
-            errx(1, "Expected `:` before %ld:%ld", AT(tok,t).lin, AT(tok,t).col);
-            break;
-
-        case pNext:
-            switch (AT(tok,t).ty) {
-            case tComma:
-                pState = pKey;
-                break;
-            case tNewline:
-                avl_insertWith((avl_AddFun)addFun, pr->names, name,
-                               pr->files.used, NULL);
-                ENOUGH(pr->files);
-                PUSH(pr->files, current);
-                current = new(struct file);
-                *current = uninitFile;
-                pState = pName;
-                break;
-            default:
-                errx(1, "Expected `,` or newline before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-            }
-            break;
-
-        case pKey:
-            if (AT(tok,t).ty != tPlain) {
-                errx(1, "Expected keyword before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-                break;
-            }
-            if (!strcmp("pass", AT(tok,t).str)) {
-                pState = pPass;
-                break;
-            }
-            if (!strcmp("fill", AT(tok,t).str)) {
-                pState = pFill;
-                break;
-            }
-            if (!strcmp("size", AT(tok,t).str)) {
-                pState = pSize;
-                break;
-            }
-            if (!strcmp("mode", AT(tok,t).str)) {
-                pState = pMode;
-                break;
-            }
-            if (!strcmp("mtime", AT(tok,t).str)) {
-                pState = pMtime;
-                break;
-            }
-            errx(1, "Unexpected key `%s` before %ld:%ld when defining `%s`",
-                 AT(tok,t).str, AT(tok,t).lin, AT(tok,t).col, name);
-            break;
-
-        case pFill: {
-            unsigned int found = 0;
-            for (unsigned int i = 1; algorithms[i]; i++) {
-                if (!strcmp(algorithms[i], AT(tok,t).str)) {
-                    found = i;
-                    break;
-                }
-            }
-            if (found) {
-                current->srcName = NULL;
-                current->srcSize = found;
-                pState = pNext;
-                break;
-            }
-            errx(1, "Unexpected fill mode `%s` before %ld:%ld",
-                 AT(tok,t).str, AT(tok,t).lin, AT(tok,t).col);
-            break;
-        }
-
-        case pPass:
-            switch (AT(tok,t).ty) {
-            case tPlain:
-            case tQuoted:
-                current->srcName = AT(tok,t).str;
-                pState = pNext;
-                break;
-            case tComma:
-            case tNewline:
-                current->srcName = name;
-                pState = pNext;
-                t--;
-                break;
-            default:
-                errx(1, "Expected source name before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-                break;
-            }
-            break;
-
-        case pSize:
-            switch (AT(tok,t).ty) {
-            case tPlain:
-                {
-                    char *e;
-                    long int x = strtol(AT(tok,t).str, &e, 10);
-                    if (x < 0 || x == LONG_MAX)
-                        errx(1, "Invalid size before %ld:%ld",
-                             AT(tok,t).lin, AT(tok,t).col);
-                    current->size = (ssize_t)x;
-                    if (*e) {
-                        off_t f = 0;
-                        for (size_t s = 0; s < sizeof(suf)/sizeof(*suf); s++) {
-                            if (!strcmp(suf[s].s, e)) {
-                                f = suf[s].f;
-                                break;
-                            }
-                        }
-                        if (!f)
-                            errx(1, "Invalid suffix `%s` before %ld:%ld",
-                                 e, AT(tok,t).lin, AT(tok,t).col);
-                        current->size *= f;
-                    }
-                    pState = pNext;
-                }
-                break;
-            default:
-                errx(1, "Expected file size before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-                break;
-            }
-            break;
-
-        case pMtime:
-            switch (AT(tok,t).ty) {
-            case tPlain:
-                {
-                    char *e;
-                    long int x = strtol(AT(tok,t).str, &e, 10);
-                    if (x < 0 || x == LONG_MAX || *e)
-                        errx(1, "Invalid unix time `%s` before %ld:%ld",
-                             AT(tok,t).str, AT(tok,t).lin, AT(tok,t).col);
-                    current->mtime = x;
-                    pState = pNext;
-                }
-                break;
-            default:
-                errx(1, "Expected file time before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-                break;
-            }
-            break;
-
-        case pMode:
-            switch (AT(tok,t).ty) {
-            case tPlain:
-                {
-                    char *e;
-                    long int x = strtol(AT(tok,t).str, &e, 8);
-                    if (x < 0 || 0777 < x || *e)
-                        errx(1, "Invalid file mode `%s` before %ld:%ld",
-                             AT(tok,t).str, AT(tok,t).lin, AT(tok,t).col);
-                    current->mode = S_IFREG | (mode_t)(x & 0777);
-                    pState = pNext;
-                }
-                break;
-            default:
-                errx(1, "Expected file mode before %ld:%ld",
-                     AT(tok,t).lin, AT(tok,t).col);
-                break;
-            }
-            break;
-
-        }
+    /* The last line may lack its newline. */
+    switch (state) {
+    case sQuoted:
+        errx(1, "Unterminated `\"` before %ld:%ld", lin, col);
+        break;
+    case sPlain:
+        tk = (struct token){ tPlain, arena_str(a), lin, col };
+        feed(&p, &tk);
+        arena_drop(a);
+        // fall through
+    default:
+        tk = (struct token){ tNewline, 0, lin, col };
+        feed(&p, &tk);
+        break;
     }
 
-    free(tok.array);
+    free(p.current);
 
     return 0;
 }
@@ -3,6 +3,9 @@
 
 #include "common.h"
 
+/* Add the files defined in the config `fd` to `parseResult`, and
+   close `fd`.  Terminates the program on errors. */
+
 int parse(struct fileSystem *parseResult, int fd);
 
 #endif
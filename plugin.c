@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "otffs_plugin.h"
+#include "plugin.h"
+#include "probes.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+
+/* See `plugin.h` for documentation. */
+
+struct plugin {
+    void *lib; // from dlopen(3)
+    const struct otffs_producer *p;
+    void *ctx;
+    size_t size; // natural, at most `SSIZE_MAX`
+    const char *tile; // NULL: none
+    size_t tileLen;
+};
+
+
+
+struct plugin *plugin_open(const char *path, const char *args,
+                           const char **why) {
+
+    void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (! lib) {
+        *why = dlerror();
+        return NULL;
+    }
+
+    const struct otffs_producer *p = dlsym(lib, "otffs_producer");
+    if (! p || p->abi != OTFFS_PLUGIN_ABI
+        || ! p->open || ! p->close || ! p->size || ! p->fill) {
+        *why = p ? "Plugin of another ABI version"
+                 : "Plugin does not define `otffs_producer`";
+        dlclose(lib);
+        return NULL;
+    }
+
+    errno = 0;
+    void *ctx = p->open(args ? args : "");
+    if (! ctx) {
+        *why = errno ? strerror(errno) : "Plugin rejected its args";
+        dlclose(lib);
+        return NULL;
+    }
+
+    uint64_t size = p->size(ctx);
+    if (! size) {
+        *why = "Plugin has no size";
+        p->close(ctx);
+        dlclose(lib);
+        return NULL;
+    }
+
+    struct plugin *pl = new(struct plugin);
+    *pl = (struct plugin){
+        .lib = lib,
+        .p = p,
+        .ctx = ctx,
+        .size = (size_t)min(size, (uint64_t)SSIZE_MAX),
+    };
+    if (p->tile) {
+        pl->tile = p->tile(ctx, &pl->tileLen);
+        if (! pl->tileLen)
+            pl->tile = NULL;
+    }
+    return pl;
+}
+
+void plugin_free(struct plugin *pl) {
+    pl->p->close(pl->ctx);
+    dlclose(pl->lib);
+    free(pl);
+}
+
+
+
+size_t plugin_size(const struct plugin *pl) {
+    return pl->size;
+}
+
+const char *plugin_tile(const struct plugin *pl, size_t *len) {
+    *len = pl->tileLen;
+    return pl->tile;
+}
+
+void plugin_fill(const struct file *fp, size_t off, size_t len, char *buf) {
+
+    const struct plugin *pl = fp->plugin;
+    PROBE4(plugin, fp->ino, off, len, len);
+
+    if (! pl->tile) {
+        struct iovec iov = { .iov_base = buf, .iov_len = len };
+        pl->p->fill(pl->ctx, off, len, &iov, 1);
+        return;
+    }
+
+    for (size_t s = off % pl->tileLen, n; len; s = 0) {
+        n = min(pl->tileLen - s, len);
+        memcpy(buf, pl->tile + s, n);
+        buf += n;
+        len -= n;
+    }
+}
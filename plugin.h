@@ -0,0 +1,36 @@
+/* Files produced by plugins, `fill plugin`, see `otffs_plugin.h` for
+   the interface plugins implement. */
+
+#ifndef plugin_Ug2kVm7RzPc4
+#define plugin_Ug2kVm7RzPc4
+
+#include <stddef.h>
+
+struct file;
+struct plugin;
+
+/* Load the plugin at `path`, and make a context for `args`, which may
+   be `NULL`.  On failure, return `NULL`, and set `*why`. */
+
+struct plugin *plugin_open(const char *path, const char *args,
+                           const char **why);
+
+/* Free the context, and unload the plugin unless used by others. */
+
+void plugin_free(struct plugin *pl);
+
+/* Return the natural size of the content. */
+
+size_t plugin_size(const struct plugin *pl);
+
+/* Return the buffer the content is a repetition of, and store its
+   length in `*len`.  Return `NULL` if there is none. */
+
+const char *plugin_tile(const struct plugin *pl, size_t *len);
+
+/* Store the `len` bytes of content at offset `off` of `fp`, a file
+   with a plugin, in `buf`. */
+
+void plugin_fill(const struct file *fp, size_t off, size_t len, char *buf);
+
+#endif
@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "prng.h"
+#include "probes.h"
+#include <assert.h>
+#include <endian.h>
+#include <math.h>
+
+/* See `prng.h` for documentation. */
+
+
+
+/* Used for seeding, see <https://prng.di.unimi.it/splitmix64.c>.  As
+   every output is a function of the state only, `mix(x + i * GAMMA)`
+   is the `i`th output after `x`, which makes it counter-based. */
+
+#define GAMMA 0x9e3779b97f4a7c15
+
+static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static uint64_t splitmix64(uint64_t *x) {
+    return mix(*x += GAMMA);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/* xoshiro256**, see <https://prng.di.unimi.it/xoshiro256starstar.c>. */
+
+static uint64_t xoshiro(uint64_t *s) {
+    uint64_t r = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return r;
+}
+
+/* MT19937, see <http://www.math.sci.hiroshima-u.ac.jp/m-mat/MT/emt.html>. */
+
+static void mtSeed(struct prng *p, uint32_t seed) {
+    uint32_t *x = p->s.mt.x;
+    x[0] = seed;
+    for (uint32_t i = 1; i < 624; i++)
+        x[i] = 1812433253U * (x[i - 1] ^ (x[i - 1] >> 30)) + i;
+    p->s.mt.i = 624;
+}
+
+static uint32_t mt(struct prng *p) {
+    uint32_t *x = p->s.mt.x;
+    if (p->s.mt.i >= 624) {
+        for (int i = 0; i < 624; i++) {
+            uint32_t y = (x[i] & 0x80000000U) | (x[(i + 1) % 624] & 0x7fffffffU);
+            x[i] = x[(i + 397) % 624] ^ (y >> 1) ^ (y & 1 ? 0x9908b0dfU : 0);
+        }
+        p->s.mt.i = 0;
+    }
+    uint32_t y = x[p->s.mt.i++];
+    y ^= y >> 11;
+    y ^= (y << 7) & 0x9d2c5680U;
+    y ^= (y << 15) & 0xefc60000U;
+    return y ^ (y >> 18);
+}
+
+
+
+/* Size of output words of `fp`. */
+
+static size_t word(const struct file *fp) {
+    return fp->srcSize == algoXoshiro ? 8 : 4;
+}
+
+/* Store the next output word of `p` in `w`, little endian. */
+
+static void next(const struct file *fp, struct prng *p, unsigned char *w) {
+    uint64_t v = fp->srcSize == algoXoshiro ? xoshiro(p->s.xo) : mt(p);
+    for (size_t i = 0; i < word(fp); i++, v >>= 8)
+        w[i] = (unsigned char)v;
+    p->pos += word(fp);
+}
+
+/* Return the seed of block `b` of `fp`. */
+
+static uint64_t blockSeed(const struct file *fp, size_t b) {
+    return fp->param.seed ^ (b * 0xd1342543de82ef95);
+}
+
+/* Set `p` to the start of block `b`. */
+
+static void seed(const struct file *fp, struct prng *p, size_t b) {
+    uint64_t x = blockSeed(fp, b);
+    if (fp->srcSize == algoXoshiro) {
+        for (int i = 0; i < 4; i++)
+            p->s.xo[i] = splitmix64(&x);
+    } else {
+        mtSeed(p, (uint32_t)splitmix64(&x));
+    }
+    p->block = b;
+    p->pos = 0;
+}
+
+
+
+void prng_init(struct prng *p) {
+    p->block = SIZE_MAX;
+    p->pos = 0;
+}
+
+size_t prng_block(const struct file *fp) {
+    if (fp->param.block)
+        return fp->param.block;
+    if (fp->srcSize == algoCompressible || fp->srcSize == algoDedup)
+        return COMPRESSIBLE_BLOCK;
+    return PRNG_BLOCK;
+}
+
+uint64_t prng_hash(uint64_t seed, uint64_t i, uint64_t j) {
+    return mix(mix(seed ^ (i * 0xd1342543de82ef95)) + (j + 1) * GAMMA);
+}
+
+size_t prng_unique(const struct file *fp) {
+    return fp->param.unique ? fp->param.unique : DEDUP_UNIQUE;
+}
+
+
+
+void prng_fill(const struct file *fp, struct prng *p, size_t off, size_t len,
+               char *buf) {
+
+    PROBE4(prng, fp->ino, off, len, len);
+
+    const size_t block = prng_block(fp), w = word(fp);
+    assert(block % 8 == 0);
+    unsigned char tmp[8];
+
+    while (len) {
+        size_t b = off / block, in = off % block;
+
+        /* Start over at the beginning of the block, unless the
+           checkpoint is before `off` in the same block. */
+        if (p->block != b || p->pos > in)
+            seed(fp, p, b);
+        while (p->pos + w <= in)
+            next(fp, p, tmp);
+
+        size_t n = min(len, block - in);
+        size_t done = 0;
+
+        /* A partial word at the start. */
+        if (p->pos < in) {
+            size_t d = in - p->pos;
+            next(fp, p, tmp);
+            done = min(w - d, n);
+            memcpy(buf, tmp + d, done);
+        }
+
+        /* Whole words. */
+        for (; done + w <= n; done += w)
+            next(fp, p, (unsigned char *)buf + done);
+
+        /* A partial word at the end, without moving the checkpoint
+           past it. */
+        if (done < n) {
+            struct prng q = *p;
+            next(fp, &q, tmp);
+            memcpy(buf + done, tmp, n - done);
+        }
+
+        off += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+
+
+/* Store bytes [from, to) of the counter-based stream `key` in `buf`.
+   Words are independent of each other, so the loop vectorises. */
+
+static void stream(uint64_t key, size_t from, size_t to, char *buf) {
+    unsigned char tmp[8];
+    size_t w = from / 8, i = 0, n = to - from;
+
+    if (from % 8) {
+        uint64_t v = htole64(mix(key + ++w * GAMMA));
+        memcpy(tmp, &v, 8);
+        i = min(8 - from % 8, n);
+        memcpy(buf, tmp + from % 8, i);
+    }
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v = htole64(mix(key + ++w * GAMMA));
+        memcpy(buf + i, &v, 8);
+    }
+    if (i < n) {
+        uint64_t v = htole64(mix(key + ++w * GAMMA));
+        memcpy(buf + i, &v, n - i);
+    }
+}
+
+void prng_compressible(const struct file *fp, size_t off, size_t len,
+                       char *buf) {
+
+    PROBE4(compressible, fp->ino, off, len, len);
+
+    const size_t block = prng_block(fp);
+    const double ratio = fp->param.ratio ? fp->param.ratio
+        : COMPRESSIBLE_RATIO;
+
+    /* Bytes of each block that are random, at least one so blocks
+       differ from each other. */
+    size_t random = (size_t)((double)block / ratio + 0.5);
+    random = max(random, 1);
+
+    while (len) {
+        size_t b = off / block, in = off % block;
+        size_t n = min(len, block - in);
+        uint64_t key = mix(blockSeed(fp, b));
+
+        size_t r = in < random ? min(random - in, n) : 0;
+        stream(key, in, in + r, buf);
+        memset(buf + r, (unsigned char)(key >> 56), n - r);
+
+        off += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+
+
+/* Sampling from the Zipf distribution by rejection-inversion, see
+   W. Hörmann, G. Derflinger: Rejection-inversion to generate variates
+   from monotone discrete distributions, ACM TOMACS 6(3), 1996.  This
+   takes constant expected time and no tables, so block numbers map to
+   pool members without any state. */
+
+struct zipf {
+    double s; // exponent
+    double hx1, hn, t; // constants of the sampler for `n` elements
+    size_t n;
+};
+
+/* log1p(x)/x and expm1(x)/x, precise near 0. */
+
+static double helper1(double x) {
+    if (fabs(x) > 1e-8)
+        return log1p(x) / x;
+    return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x) {
+    if (fabs(x) > 1e-8)
+        return expm1(x) / x;
+    return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double h(const struct zipf *z, double x) {
+    return exp(-z->s * log(x));
+}
+
+static double hIntegral(const struct zipf *z, double x) {
+    double l = log(x);
+    return helper2((1 - z->s) * l) * l;
+}
+
+static double hIntegralInverse(const struct zipf *z, double x) {
+    double t = x * (1 - z->s);
+    if (t < -1)
+        t = -1;
+    return exp(helper1(t) * x);
+}
+
+static void zipfInit(struct zipf *z, double s, size_t n) {
+    z->s = s;
+    z->n = n;
+    z->hx1 = hIntegral(z, 1.5) - 1;
+    z->hn = hIntegral(z, (double)n + 0.5);
+    z->t = 2 - hIntegralInverse(z, hIntegral(z, 2.5) - h(z, 2));
+}
+
+/* Return a sample in [0, n), 0 being the most likely, drawing uniform
+   numbers from the counter-based stream `key`. */
+
+static size_t zipf(const struct zipf *z, uint64_t key) {
+    for (uint64_t i = 1;; i++) {
+        double r = (double)(mix(key + i * GAMMA) >> 11) * 0x1p-53;
+        double u = z->hn + r * (z->hx1 - z->hn);
+        double x = hIntegralInverse(z, u);
+        double k = floor(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > (double)z->n)
+            k = (double)z->n;
+        if (k - x <= z->t || u >= hIntegral(z, k + 0.5) - h(z, k))
+            return (size_t)k - 1;
+    }
+}
+
+void prng_dedup(const struct file *fp, size_t off, size_t len, char *buf) {
+
+    PROBE4(dedup, fp->ino, off, len, len);
+
+    const size_t block = prng_block(fp), unique = prng_unique(fp);
+    struct zipf z;
+    if (fp->param.skew)
+        zipfInit(&z, fp->param.skew, unique);
+
+    while (len) {
+        size_t b = off / block, in = off % block;
+        size_t n = min(len, block - in);
+
+        /* Pick the pool member, and produce it from its number.  Keys
+           of members and of picks must not collide, hence the `~`. */
+        uint64_t pick = mix(blockSeed(fp, b)), member;
+        if (fp->param.skew)
+            member = zipf(&z, pick);
+        else
+            member = pick % unique;
+        stream(mix(~blockSeed(fp, member)), in, in + n, buf);
+
+        off += n;
+        buf += n;
+        len -= n;
+    }
+}
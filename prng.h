@@ -0,0 +1,92 @@
+/* Seekable pseudo-random content from classic long-period generators,
+   xoshiro256** and the Mersenne Twister MT19937.
+
+   The file is cut into blocks, and each block is the output of the
+   generator seeded from the seed of the file and the number of the
+   block.  So reading at any offset takes at most one block of
+   generator output to get there.  A `struct prng` is a checkpoint:
+   It keeps the generator state where the previous read stopped, so a
+   sequential reader continues without any detour.
+
+   `compressible` content is made for benchmarking compression.  Each
+   block is a run of random bytes, followed by a run of a single byte
+   value, so compressors shrink it by the configured ratio.  The random
+   bytes come from a counter-based generator, so every byte is computed
+   directly from its block and offset, without any state.
+
+   `dedup` content is made for benchmarking deduplication.  Each block
+   is a copy of one of a pool of unique blocks, picked by a hash of the
+   number of the block, uniformly or following a Zipf distribution.
+   Pool members are produced from their number like `compressible`
+   blocks, so the pool takes no memory.
+
+   Output words are stored little endian, so files are the same on
+   every machine. */
+
+#ifndef prng_Lc6vRt3MzWq9
+#define prng_Lc6vRt3MzWq9
+
+#include "common.h"
+
+/* Default number of bytes per block.  Must be a multiple of 8. */
+
+#define PRNG_BLOCK (1UL << 20)
+
+/* Default number of bytes per block of `compressible`, a typical unit
+   of compression in storage, and the default ratio. */
+
+#define COMPRESSIBLE_BLOCK (4UL << 10)
+#define COMPRESSIBLE_RATIO 2.0
+
+/* Default number of unique blocks of `dedup`. */
+
+#define DEDUP_UNIQUE 1024UL
+
+struct prng {
+    size_t block; // number of the block the state is in, SIZE_MAX: none
+    size_t pos; // offset into the block of the next output word
+    union {
+        uint64_t xo[4];
+        struct {
+            uint32_t x[624];
+            size_t i; // next word in `x` to output
+        } mt;
+    } s;
+};
+
+/* Initialise `p` to not hold any state. */
+
+void prng_init(struct prng *p);
+
+/* Store the `len` bytes of `fp` at offset `off` in `buf`.  `fp` is
+   produced by `algoXoshiro` or `algoMt19937`.  `p` is the checkpoint
+   to start from if it fits, and is updated to the end of the range. */
+
+void prng_fill(const struct file *fp, struct prng *p, size_t off, size_t len,
+               char *buf);
+
+/* Store the `len` bytes of `fp` at offset `off` in `buf`.  `fp` is
+   produced by `algoCompressible`. */
+
+void prng_compressible(const struct file *fp, size_t off, size_t len,
+                       char *buf);
+
+/* Store the `len` bytes of `fp` at offset `off` in `buf`.  `fp` is
+   produced by `algoDedup`. */
+
+void prng_dedup(const struct file *fp, size_t off, size_t len, char *buf);
+
+/* Return the number of unique blocks of `fp`, produced by `algoDedup`. */
+
+size_t prng_unique(const struct file *fp);
+
+/* Return word `j` of the counter-based stream of item `i` of a file
+   with seed `seed`.  For producers of other content. */
+
+uint64_t prng_hash(uint64_t seed, uint64_t i, uint64_t j);
+
+/* Return the number of bytes per block of `fp`. */
+
+size_t prng_block(const struct file *fp);
+
+#endif
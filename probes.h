@@ -0,0 +1,57 @@
+/* Static tracepoints for perf(1), bpftrace(8) and friends, compatible
+   with SystemTap's `sys/sdt.h`.  A disabled probe costs a single nop
+   instruction.  List them with, e.g.,
+
+       $ bpftrace -l 'usdt:./otffs:*'
+
+   Every FUSE operation `op` has probes `op_entry`, and `op_return`
+   as the reply is sent.  Arguments are inode (the parent for `lookup`
+   and `unlink`), offset and length, and for `op_return` the result:
+   A negative error number, or the number of bytes replied for `read`,
+   `readdir` and `write`, or the inode found by `lookup`, or 0.
+   Arguments that do not apply to an operation are 0.
+
+   Content is produced by `otffs_fillFrom`, in every program using
+   libotffs, with probes `fill_entry` and `fill_return`.  Each producer
+   has a probe as it starts: `source` for `pass` files, `sequence`,
+   `prng`, `compressible`, `dedup`, `record` and `plugin`.  Arguments
+   are inode, offset and length, and the result, the number of bytes
+   produced.  Producers cannot fail, so that is the length.
+
+   Replies of `read` made without copying, or assembled from pieces,
+   have probes `file` (mapped `pass` files), `tile`, `overlay`, and
+   `profile`, with arguments inode, offset, length, and the number of
+   pieces the reply is made of.  For `profile`, the last argument is
+   the delay of the reply in ns instead.
+
+   Without `sys/sdt.h`, or with `-DNO_PROBES`, probes compile to
+   nothing. */
+
+#ifndef probes_Rk3wTz9HcLq2
+#define probes_Rk3wTz9HcLq2
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_PROBES
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(otffs, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(otffs, name, a, b, c, d)
+
+#else
+
+/* Arguments are not evaluated, but count as used. */
+
+#define PROBE3(name, a, b, c)                                   \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define PROBE4(name, a, b, c, d)                                        \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "profile.h"
+#include <time.h>
+
+/* See `profile.h` for documentation. */
+
+
+
+struct profile *profile_new(void) {
+    struct profile *p = new(struct profile);
+    *p = (struct profile){
+        .rate = 0,
+        .latency = 0,
+        .jitter = 0,
+        .stall = 0,
+        .every = 0,
+        .busy = 0,
+        .served = 0,
+        .rng = 0x9e3779b97f4a7c15,
+    };
+    ERRIF(pthread_mutex_init(&p->lock, NULL));
+    return p;
+}
+
+
+
+void profile_free(struct profile *p) {
+    ERRIF(pthread_mutex_destroy(&p->lock));
+    free(p);
+}
+
+
+
+long profile_now(void) {
+    struct timespec ts;
+    ERRIF(clock_gettime(CLOCK_MONOTONIC, &ts));
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+
+long profile_due(struct profile *p, size_t len, long now) {
+
+    ERRIF(pthread_mutex_lock(&p->lock));
+
+    /* Transfers are serialised on the device... */
+    long t = max(now, p->busy);
+    if (p->rate)
+        t += (long)((double)len * 1e9 / (double)p->rate);
+
+    /* ...and so are the stalls. */
+    if (p->every)
+        t += p->stall * (long)((p->served + len) / p->every
+                               - p->served / p->every);
+    p->served += len;
+    p->busy = t;
+
+    /* Latency does not keep the device busy, requests overlap. */
+    long j = 0;
+    if (p->jitter) {
+        p->rng ^= p->rng << 13;
+        p->rng ^= p->rng >> 7;
+        p->rng ^= p->rng << 17;
+        j = (long)(p->rng % (2 * (uint64_t)p->jitter + 1)) - p->jitter;
+    }
+
+    ERRIF(pthread_mutex_unlock(&p->lock));
+
+    return max(now, t + p->latency + j);
+}
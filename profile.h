@@ -0,0 +1,44 @@
+/* Emulated storage performance.  A file with a profile behaves like
+   it was stored on a device with limited bandwidth, latency per
+   request, and stalls at regular intervals. */
+
+#ifndef profile_Hn2xVb8QmTcw
+#define profile_Hn2xVb8QmTcw
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct profile {
+    size_t rate; // bytes per second, 0: unlimited
+    long latency; // ns added to every request
+    long jitter; // ns, latency varies by up to ± this much
+    long stall; // ns of stall...
+    size_t every; // ...after this many bytes served, 0: never
+
+    pthread_mutex_t lock; // protects the following
+    long busy; // the emulated device is busy until then
+    size_t served; // bytes served so far
+    uint64_t rng; // state for jitter
+};
+
+/* Return a new profile without any limitations.  Terminates the
+   program on failure. */
+
+struct profile *profile_new(void);
+
+/* Free the profile. */
+
+void profile_free(struct profile *p);
+
+/* Account for a request of `len` bytes arriving at time `now`, and
+   return the time it would complete on the emulated device.  Times
+   are in ns, see `profile_now`. */
+
+long profile_due(struct profile *p, size_t len, long now);
+
+/* Current time in ns, from CLOCK_MONOTONIC. */
+
+long profile_now(void);
+
+#endif
@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "prng.h"
+#include "probes.h"
+#include "record.h"
+#include <assert.h>
+#include <ctype.h>
+
+/* See `record.h` for documentation. */
+
+/* Milliseconds from the epoch to 2020-01-01T00:00:00Z. */
+
+#define RECORD_EPOCH 1577836800000ULL
+
+#define ID_MOD 1000000000000ULL
+
+static const struct {
+    const char *s;
+    int type;
+    size_t width;
+} types[] = {
+    { "id", rId, 12 }, { "int", rInt, 9 }, { "float", rFloat, 8 },
+    { "time", rTime, 24 },
+};
+
+
+
+/* Whether values of `type` are strings in JSON. */
+
+static int quoted(int type) {
+    return type == rStr || type == rTime;
+}
+
+
+
+int record_parse(const char *spec, int json, struct record *r) {
+
+    zero(r);
+    r->json = json;
+
+    for (const char *s = spec; *s; ) {
+        if (*s == ' ') {
+            s++;
+            continue;
+        }
+        if (r->fields == RECORD_MAX_FIELDS)
+            return -1;
+
+        /* The name, if any, then the type. */
+        const char *e = s;
+        while (isalnum(*e) || *e == '_')
+            e++;
+        const char *t = s;
+        if (*e == ':') {
+            t = e + 1;
+            if (e == s)
+                return -1;
+        }
+        r->field[r->fields].name = s;
+        r->field[r->fields].nameLen = (size_t)(e - s);
+
+        size_t n = 0;
+        int k = -1;
+        for (size_t i = 0; i < sizeof(types) / sizeof(*types); i++) {
+            n = strlen(types[i].s);
+            if (! strncmp(t, types[i].s, n) && (! t[n] || t[n] == ' ')) {
+                k = (int)i;
+                break;
+            }
+        }
+        if (k >= 0) {
+            r->field[r->fields].type = types[k].type;
+            r->field[r->fields].width = types[k].width;
+        } else {
+            char *end;
+            if (strncmp(t, "str(", 4) || ! isdigit(t[4]))
+                return -1;
+            unsigned long w = strtoul(t + 4, &end, 10);
+            if (*end != ')' || w < 1 || w > 1000)
+                return -1;
+            r->field[r->fields].type = rStr;
+            r->field[r->fields].width = w;
+            n = (size_t)(end + 1 - t);
+        }
+        if (json && quoted(r->field[r->fields].type))
+            r->field[r->fields].width += 2;
+        if (t == s) // named after its type
+            r->field[r->fields].nameLen = n;
+        s = t + n;
+        if (*s && *s != ' ')
+            return -1;
+        r->fields++;
+    }
+    if (! r->fields)
+        return -1;
+
+    /* CSV: `a,b\n`, JSON: `{"a":a,"b":b}\n`. */
+    for (size_t f = 0; f < r->fields; f++) {
+        r->stride += r->field[f].width + 1; // and `,` or `\n`
+        if (json)
+            r->stride += r->field[f].nameLen + 3; // `"a":`
+        else
+            r->header += r->field[f].nameLen + 1;
+    }
+    if (json)
+        r->stride += 2; // `{}`
+    return r->stride > RECORD_MAX || r->header > RECORD_MAX ? -1 : 0;
+}
+
+void record_layout(const struct file *fp, struct record *r) {
+    int err = record_parse(fp->param.fields ? fp->param.fields : RECORD_FIELDS,
+                           fp->srcSize == algoJsonl, r);
+    assert(! err);
+    (void)err;
+}
+
+
+
+/* Write `v` right-aligned into `width` bytes at `p`, padded with
+   `pad`, and return the end. */
+
+static char *number(char *p, uint64_t v, size_t width, char pad) {
+    for (size_t i = width; i--; v /= 10)
+        p[i] = v || i == width - 1 ? (char)('0' + v % 10) : pad;
+    return p + width;
+}
+
+/* Write the time stamp `ms` after the epoch at `p`, and return the end.
+   Days to dates as in <http://howardhinnant.github.io/date_algorithms.html>. */
+
+static char *timeStamp(char *p, uint64_t ms) {
+    uint64_t s = ms / 1000, z = s / 86400 + 719468;
+    uint64_t era = z / 146097, doe = z % 146097;
+    uint64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint64_t mp = (5 * doy + 2) / 153;
+    uint64_t d = doy - (153 * mp + 2) / 5 + 1, m = mp < 10 ? mp + 3 : mp - 9;
+    uint64_t y = yoe + era * 400 + (m <= 2);
+
+    p = number(p, y, 4, '0');
+    *p++ = '-';
+    p = number(p, m, 2, '0');
+    *p++ = '-';
+    p = number(p, d, 2, '0');
+    *p++ = 'T';
+    p = number(p, s / 3600 % 24, 2, '0');
+    *p++ = ':';
+    p = number(p, s / 60 % 60, 2, '0');
+    *p++ = ':';
+    p = number(p, s % 60, 2, '0');
+    *p++ = '.';
+    p = number(p, ms % 1000, 3, '0');
+    *p++ = 'Z';
+    return p;
+}
+
+/* Write record `i` of `fp` with layout `r` at `p`, `r->stride` bytes. */
+
+static void produce(const struct file *fp, const struct record *r, size_t i,
+                    char *p) {
+
+    const char pad = r->json ? ' ' : '0';
+    uint64_t j = 0; // next word of the record's random stream
+
+    if (r->json)
+        *p++ = '{';
+    for (size_t f = 0; f < r->fields; f++) {
+        const int q = r->json && quoted(r->field[f].type);
+        if (r->json) {
+            *p++ = '"';
+            memcpy(p, r->field[f].name, r->field[f].nameLen);
+            p += r->field[f].nameLen;
+            *p++ = '"';
+            *p++ = ':';
+        }
+        if (q)
+            *p++ = '"';
+        switch (r->field[f].type) {
+        case rId:
+            p = number(p, i % ID_MOD, 12, pad);
+            break;
+        case rInt:
+            p = number(p, prng_hash(fp->param.seed, i, j++) % 1000000000, 9,
+                       pad);
+            break;
+        case rFloat:
+            *p++ = '0';
+            *p++ = '.';
+            p = number(p, prng_hash(fp->param.seed, i, j++) % 1000000, 6, '0');
+            break;
+        case rTime:
+            p = timeStamp(p, RECORD_EPOCH + i % ID_MOD);
+            break;
+        case rStr: {
+            size_t n = r->field[f].width - (q ? 2 : 0);
+            for (size_t k = 0; k < n; k += 8) {
+                uint64_t w = prng_hash(fp->param.seed, i, j++);
+                for (size_t b = k; b < n && b < k + 8; b++, w >>= 8)
+                    *p++ = (char)('a' + ((w & 0xff) * 26 >> 8));
+            }
+            break;
+        }
+        }
+        if (q)
+            *p++ = '"';
+        *p++ = f + 1 < r->fields ? ',' : r->json ? '}' : '\n';
+    }
+    if (r->json)
+        *p = '\n';
+}
+
+/* Write the header of `r` at `p`. */
+
+static void header(const struct record *r, char *p) {
+    for (size_t f = 0; f < r->fields; f++) {
+        memcpy(p, r->field[f].name, r->field[f].nameLen);
+        p += r->field[f].nameLen;
+        *p++ = f + 1 < r->fields ? ',' : '\n';
+    }
+}
+
+
+
+void record_fill(const struct file *fp, size_t off, size_t len, char *buf) {
+
+    PROBE4(record, fp->ino, off, len, len);
+
+    struct record r;
+    record_layout(fp, &r);
+    char tmp[RECORD_MAX];
+
+    if (off < r.header) {
+        size_t n = min(len, r.header - off);
+        header(&r, tmp);
+        memcpy(buf, tmp + off, n);
+        off += n;
+        buf += n;
+        len -= n;
+    }
+
+    while (len) {
+        size_t i = (off - r.header) / r.stride, in = (off - r.header) % r.stride;
+        size_t n = min(len, r.stride - in);
+
+        /* Whole records go to `buf` directly. */
+        if (n == r.stride) {
+            produce(fp, &r, i, buf);
+        } else {
+            produce(fp, &r, i, tmp);
+            memcpy(buf, tmp + in, n);
+        }
+
+        off += n;
+        buf += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,60 @@
+/* Seekable text records, as CSV or JSON Lines, for `fill csv` and
+   `fill jsonl`.  Record `i` is made from the seed of the file and `i`
+   alone, so any record is produced without producing the others.
+
+   Every field type has a fixed width, so all records of a file have
+   the same length, the stride.  The record at offset `off` is found by
+   a division.  A CSV file starts with a header line naming the fields.
+
+   Numbers are padded to their width, with zeros in CSV, and with
+   spaces in JSON, which does not allow leading zeros.  The field types
+   are
+
+       id      the number of the record, modulo 10^12
+       int     a random integer in [0, 10^9)
+       float   a random number in [0, 1), with 6 decimals
+       time    UTC time stamp, with ms, starting 2020, 1ms per record
+       str(n)  n random lower case letters, 1 <= n <= 1000
+
+   The fields of a file are given like "id:id user:str(8) at:time",
+   as names and types separated by `:`, or just a type to name the
+   field after its type. */
+
+#ifndef record_Tz4pWq8KmXn2
+#define record_Tz4pWq8KmXn2
+
+#include "common.h"
+
+/* Fields when not given, and limits. */
+
+#define RECORD_FIELDS "id:id value:int ratio:float name:str(12) at:time"
+
+enum { RECORD_MAX_FIELDS = 32, RECORD_MAX = 4096 };
+
+struct record {
+    int json; // JSON Lines, else CSV
+    size_t fields;
+    struct {
+        enum { rId, rInt, rFloat, rTime, rStr } type;
+        const char *name; // not NUL-terminated
+        size_t nameLen, width; // of the name and of the value
+    } field[RECORD_MAX_FIELDS];
+    size_t header; // bytes before the first record
+    size_t stride; // bytes per record, including the newline
+};
+
+/* Parse `spec` into `r`, for JSON Lines if `json`.  Names in `r` point
+   into `spec`.  Return 0, or -1 if `spec` is invalid. */
+
+int record_parse(const char *spec, int json, struct record *r);
+
+/* Set `r` to the layout of `fp`, produced by `algoCsv` or `algoJsonl`. */
+
+void record_layout(const struct file *fp, struct record *r);
+
+/* Store the `len` bytes of `fp` at offset `off` in `buf`.  `fp` is
+   produced by `algoCsv` or `algoJsonl`. */
+
+void record_fill(const struct file *fp, size_t off, size_t len, char *buf);
+
+#endif
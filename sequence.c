@@ -0,0 +1,105 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "probes.h"
+#include "sequence.h"
+#include <endian.h>
+#include <limits.h>
+
+/* See `sequence.h` for documentation. */
+
+#define htole8(x) (x)
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NATIVE_BIG 1
+#else
+#define NATIVE_BIG 0
+#endif
+
+
+
+/* Define `name`, producing the items of type `ty` of the sequence `p`,
+   converted by `order`, for offsets [off, off+len) into `buf`.  Partial
+   items at both ends are cut from a temporary. */
+
+#define SEQUENCE(name, ty, order)                                       \
+    static void name(const struct params *p, uint64_t off, size_t len,   \
+                     char *buf) {                                       \
+        const ty step = (ty)p->stride;                                  \
+        ty v = (ty)(p->start + off / sizeof(ty) * p->stride), o;        \
+        size_t d = off % sizeof(ty), i = 0;                             \
+        if (d) {                                                        \
+            o = order(v);                                               \
+            v = (ty)(v + step);                                         \
+            i = min(sizeof(ty) - d, len);                               \
+            memcpy(buf, (char *)&o + d, i);                             \
+        }                                                               \
+        for (; i + sizeof(ty) <= len; i += sizeof(ty)) {                \
+            o = order(v);                                               \
+            v = (ty)(v + step);                                         \
+            memcpy(buf + i, &o, sizeof(ty));                            \
+        }                                                               \
+        if (i < len) {                                                  \
+            o = order(v);                                               \
+            memcpy(buf + i, &o, len - i);                               \
+        }                                                               \
+    }
+
+SEQUENCE(seq8, uint8_t, htole8)
+SEQUENCE(le16, uint16_t, htole16)
+SEQUENCE(be16, uint16_t, htobe16)
+SEQUENCE(le32, uint32_t, htole32)
+SEQUENCE(be32, uint32_t, htobe32)
+SEQUENCE(le64, uint64_t, htole64)
+SEQUENCE(be64, uint64_t, htobe64)
+
+/* By log2 of the bytes per item, and big endian or not. */
+
+static void (*const kernels[4][2])(const struct params *, uint64_t, size_t,
+                                   char *) = {
+    { seq8, seq8 }, { le16, be16 }, { le32, be32 }, { le64, be64 },
+};
+
+/* Store the width in bits, and the byte order of the items of `fp`. */
+
+static void layout(const struct file *fp, unsigned int *width, int *big) {
+    if (fp->srcSize == algoChars) {
+        *width = 8 * sizeof(unsigned char);
+        *big = NATIVE_BIG;
+    } else if (fp->srcSize == algoIntegers) {
+        *width = 8 * sizeof(unsigned int);
+        *big = NATIVE_BIG;
+    } else {
+        *width = fp->param.width ? fp->param.width : 32;
+        *big = fp->param.bigEndian;
+    }
+}
+
+
+
+void sequence_fill(const struct file *fp, size_t off, size_t len, char *buf) {
+    PROBE4(sequence, fp->ino, off, len, len);
+    unsigned int width;
+    int big;
+    layout(fp, &width, &big);
+    kernels[__builtin_ctz(width / 8)][big](&fp->param,
+                                           off + fp->param.offset, len, buf);
+}
+
+size_t sequence_period(const struct file *fp) {
+    unsigned int width;
+    int big;
+    layout(fp, &width, &big);
+
+    /* The sequence repeats after 2^width / gcd(stride, 2^width) items,
+       a power of two. */
+    uint64_t stride = width < 64 ? fp->param.stride & ((1ULL << width) - 1)
+                                 : fp->param.stride;
+    unsigned int items = stride ? width - (unsigned int)__builtin_ctzll(stride)
+                                : 0;
+    unsigned int bytes = items + (unsigned int)__builtin_ctz(width / 8);
+
+    if (bytes >= 63)
+        return (size_t)SSIZE_MAX / (width / 8) * (width / 8);
+    return 1UL << bytes;
+}
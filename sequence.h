@@ -0,0 +1,26 @@
+/* Arithmetic sequences of unsigned integers, for `fill sequence`, and
+   for `fill integers` and `fill chars`, which are sequences of 32 and
+   8 bits in native byte order.
+
+   Item `i` of the sequence is `start + i * stride`, modulo 2^width.
+   The file starts `offset` bytes into the sequence.  Each combination
+   of width and byte order has its own loop, so producing an item is an
+   addition and a store, and nothing is decided per item.  Counting
+   is done in 64 bits, so 64-bit sequences do not wrap before 2^64. */
+
+#ifndef sequence_Hq7nVb2XcRt5
+#define sequence_Hq7nVb2XcRt5
+
+#include "common.h"
+
+/* Store the `len` bytes of `fp` at offset `off` in `buf`.  `fp` is
+   produced by `algoSequence`, `algoIntegers` or `algoChars`. */
+
+void sequence_fill(const struct file *fp, size_t off, size_t len, char *buf);
+
+/* Return the number of bytes of `fp` before the sequence repeats, at
+   most `SSIZE_MAX`. */
+
+size_t sequence_period(const struct file *fp);
+
+#endif
@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "stats.h"
+#include <stdio.h>
+
+/* See `stats.h` for documentation. */
+
+#define count(x, n) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED)
+#define peek(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+
+
+/* Bucket of `x`: 0 for 0 and 1, `i` for [2^i, 2^(i+1)). */
+
+static int bucket(size_t x) {
+    return 63 - __builtin_clzl(x | 1);
+}
+
+/* Write `2^i` into `buf`, with a binary suffix. */
+
+static void human(char *buf, size_t size, int i) {
+    static const char suffix[] = " kMGTPE";
+    if (i == 0)
+        snprintf(buf, size, "0");
+    else
+        snprintf(buf, size, "%lu%c", 1UL << (i % 10), suffix[i / 10]);
+}
+
+
+
+struct stats *stats_get(struct stats **p) {
+
+    struct stats *s = __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    if (s)
+        return s;
+
+    s = new(struct stats);
+    zero(s);
+    s->refs = 1;
+
+    /* Another thread may be faster. */
+    struct stats *none = NULL;
+    if (__atomic_compare_exchange_n(p, &none, s, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return s;
+    free(s);
+    return none;
+}
+
+
+
+struct stats *stats_share(struct stats *s) {
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    return s;
+}
+
+void stats_free(struct stats *s) {
+    if (! __atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL))
+        free(s);
+}
+
+
+
+void stats_read(struct stats *s, size_t off, size_t len, int sequential) {
+    count(s->reads, 1);
+    count(s->bytes, len);
+    count(s->size[bucket(len)], 1);
+    count(s->offset[bucket(off)], 1);
+    if (sequential)
+        count(s->sequential, 1);
+    else
+        count(s->random, 1);
+}
+
+void stats_produce(struct stats *s, size_t produced, size_t coalesced) {
+    count(s->produced, produced);
+    count(s->coalesced, coalesced);
+}
+
+void stats_handle(struct stats *s, size_t seq, size_t rnd) {
+    if (! seq && ! rnd)
+        return;
+    if (rnd * 8 <= seq + rnd)
+        count(s->seqHandles, 1);
+    else
+        count(s->rndHandles, 1);
+}
+
+
+
+void stats_dump(const struct stats *s, int fd, const char *name, size_t ino) {
+
+    dprintf(fd, "%s (inode %zu): %zu reads, %zu bytes, "
+            "%zu sequential, %zu random; "
+            "handles: %zu sequential, %zu random\n",
+            name, ino, peek(s->reads), peek(s->bytes),
+            peek(s->sequential), peek(s->random),
+            peek(s->seqHandles), peek(s->rndHandles));
+
+    if (peek(s->produced) || peek(s->coalesced))
+        dprintf(fd, "    generated %zu bytes, %zu coalesced\n",
+                peek(s->produced), peek(s->coalesced));
+
+    char buf[8];
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        size_t n = peek(s->size[i]);
+        if (n) {
+            human(buf, sizeof(buf), i);
+            dprintf(fd, "    size   %5s %12zu\n", buf, n);
+        }
+    }
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        size_t n = peek(s->offset[i]);
+        if (n) {
+            human(buf, sizeof(buf), i);
+            dprintf(fd, "    offset %5s %12zu\n", buf, n);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/* Access statistics of a file: How many reads of which sizes, where in
+   the file, and whether open handles read sequentially.  Sizes and
+   offsets are counted in buckets by powers of two, up to offsets in
+   the exabyte region.
+
+   All functions may be called concurrently on the same statistics.
+   Counting uses relaxed atomics only, so a dump taken while reads are
+   going on may be slightly inconsistent. */
+
+#ifndef stats_Gm5rXc2NqPz8
+#define stats_Gm5rXc2NqPz8
+
+#include <stddef.h>
+
+enum { STATS_BUCKETS = 64 };
+
+struct stats {
+    size_t reads, bytes;
+    size_t size[STATS_BUCKETS]; // reads by length
+    size_t offset[STATS_BUCKETS]; // reads by offset
+    size_t sequential, random; // reads continuing the previous one or not
+    size_t seqHandles, rndHandles; // handles released, see `stats_handle`
+    size_t produced, coalesced; // generated bytes, see `stats_produce`
+    size_t refs; // see `stats_share`
+};
+
+/* Return the statistics at `*p`, creating them there if `*p` is
+   `NULL`.  Terminates the program on failure. */
+
+struct stats *stats_get(struct stats **p);
+
+/* Return `s`, to be used by one more file.  Each user must call
+   `stats_free` eventually. */
+
+struct stats *stats_share(struct stats *s);
+
+/* Free the statistics, unless still shared with other users. */
+
+void stats_free(struct stats *s);
+
+/* Count a read of `len` bytes at `off`.  It is `sequential` if it
+   starts where the previous read on the same handle ended. */
+
+void stats_read(struct stats *s, size_t off, size_t len, int sequential);
+
+/* Count generated content of reads: `produced` bytes were made by the
+   reader itself, `coalesced` ones copied from a concurrent reader
+   making them anyway, see `flight.h`. */
+
+void stats_produce(struct stats *s, size_t produced, size_t coalesced);
+
+/* Count a handle being released after `seq` sequential and `rnd`
+   random reads.  A handle counts as sequential if at most one in eight
+   of its reads jumped, so reordering by readahead is tolerated. */
+
+void stats_handle(struct stats *s, size_t seq, size_t rnd);
+
+/* Write `s`, of file `name` with inode `ino`, to `fd` as text. */
+
+void stats_dump(const struct stats *s, int fd, const char *name, size_t ino);
+
+#endif
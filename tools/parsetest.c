@@ -6,14 +6,15 @@
 #include <unistd.h>
 
 
-int listFun(char *name, size_t ino, struct file **files) {
+int listFun(char *name, size_t ino, struct fileSystem *pr) {
+    struct file **files = pr->files.array;
     printf("%s (%lu B): %s (%ld B) mode=%03o mtime=%ld\n",
            name,
            files[ino]->size,
            files[ino]->srcName,
            files[ino]->srcSize,
            files[ino]->mode,
-           files[ino]->mtime
+           AT(pr->stamps, ino).mtime
            );
     return 0;
 }
@@ -22,18 +23,21 @@ int main(void) {
 
     struct fileSystem pr;
     pr.names = avl_new((avl_CmpFun)strcmp);
+    arena_init(&pr.strings);
     ALLOCATE(pr.files, 8);
+    ALLOCATE(pr.stamps, 8);
     {
         int fd = open("../demo/otffsrc", O_RDONLY);
         ERRIF(!fd);
-        parse(&pr, fd);
-        close(fd);
+        parse(&pr, fd); // closes `fd`
     }
 
     printf("\nParsed %zu entries in config file.\n", pr.files.used);
 
-    avl_traverse(pr.names, (avl_VisitorFun)listFun, pr.files.array);
+    avl_traverse(pr.names, (avl_VisitorFun)listFun, &pr);
     free(pr.files.array);
+    free(pr.stamps.array);
+    arena_free(&pr.strings);
 
     return 0;
 }
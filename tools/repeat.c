@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+
+#include "otffs_plugin.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* An example producer plugin, see `otffs_plugin.h`: The content is a
+   repetition of its args, e.g.
+
+       hello : fill plugin "tools/repeat.so", args "Hello world!\n"
+
+   With args prefixed by `fill:`, the tile is withheld, and content is
+   produced by `fill`, which must result in the same bytes.  Built as
+   `repeat.so` by the tools Makefile. */
+
+struct repeat {
+    char *text;
+    size_t len;
+    int tile; // offered as tile
+};
+
+static void *repeat_open(const char *args) {
+    struct repeat *r = malloc(sizeof(*r));
+    if (! r)
+        return NULL;
+    r->tile = strncmp(args, "fill:", 5) != 0;
+    if (! r->tile)
+        args += 5;
+    r->len = strlen(args);
+    r->text = strdup(args);
+    if (! r->len || ! r->text) {
+        free(r->text);
+        free(r);
+        errno = EINVAL;
+        return NULL;
+    }
+    return r;
+}
+
+static void repeat_close(void *ctx) {
+    struct repeat *r = ctx;
+    free(r->text);
+    free(r);
+}
+
+static uint64_t repeat_size(void *ctx) {
+    return ((struct repeat *)ctx)->len;
+}
+
+static const void *repeat_tile(void *ctx, size_t *len) {
+    struct repeat *r = ctx;
+    *len = r->len;
+    return r->tile ? r->text : NULL;
+}
+
+static void repeat_fill(void *ctx, uint64_t off, size_t len,
+                        const struct iovec *iov, int iovcnt) {
+    struct repeat *r = ctx;
+    size_t s = (size_t)(off % r->len);
+    (void)len;
+    for (int i = 0; i < iovcnt; i++) {
+        char *buf = iov[i].iov_base;
+        for (size_t j = 0; j < iov[i].iov_len; j++) {
+            buf[j] = r->text[s];
+            if (++s == r->len)
+                s = 0;
+        }
+    }
+}
+
+const struct otffs_producer otffs_producer = {
+    .abi = OTFFS_PLUGIN_ABI,
+    .open = repeat_open,
+    .close = repeat_close,
+    .size = repeat_size,
+    .tile = repeat_tile,
+    .fill = repeat_fill,
+};
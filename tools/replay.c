@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include "profile.h"
+#include "trace.h"
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Re-issue the requests recorded by `otffs -o trace=FILE` against a
+   mounted otffs.  Each thread of the trace is replayed by a thread of
+   its own, issuing the same requests in the same order.  By default,
+   requests start at the same time after the start of the replay as
+   they did after the start of the trace.  With `-f`, each thread
+   issues its requests as fast as possible.
+
+   Inodes are translated to file names using the lookups in the trace.
+   Reads of files never looked up are skipped.  Afterwards, the number
+   of requests and mean durations are reported, per operation, as
+   traced and as replayed.
+ */
+
+static const char *usage = "usage: replay [-f] <trace> <mountpoint>";
+
+static const char *opName[] = {
+    [TRACE_LOOKUP] = "lookup", [TRACE_GETATTR] = "getattr",
+    [TRACE_READ] = "read",
+};
+
+enum { OPS = TRACE_READ + 1 };
+
+/* A request from the trace. */
+
+struct request {
+    const struct trace_record *r;
+    const char *name; // for lookups
+};
+
+/* A file that has been looked up in the trace. */
+
+struct known {
+    uint64_t ino;
+    const char *name;
+    int fd; // open for reading, -1 if that failed
+};
+
+/* Everything the replaying threads share. */
+
+static struct {
+    int dirFh; // the mountpoint
+    int fast; // ignore timing
+    long t0; // start of the replay
+    int64_t first; // start of the first request in the trace
+
+    STACK(struct known) files; // sorted by inode
+
+    long took[OPS]; // total ns of replayed requests, atomically added
+    long traced[OPS]; // total ns of traced requests
+    size_t count[OPS]; // number of requests
+} job;
+
+
+
+/* Order requests by thread, then by start. */
+
+static int byThread(const void *a, const void *b) {
+    const struct trace_record *x = ((const struct request *)a)->r;
+    const struct trace_record *y = ((const struct request *)b)->r;
+    if (x->thread != y->thread)
+        return x->thread < y->thread ? -1 : 1;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static int byIno(const void *a, const void *b) {
+    const struct known *x = a, *y = b;
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+/* Return the file with inode `ino`, or `NULL` if not known. */
+
+static struct known *known(uint64_t ino) {
+    struct known k = { .ino = ino };
+    return bsearch(&k, job.files.array, job.files.used,
+                   sizeof(struct known), byIno);
+}
+
+
+
+/* Issue one request. */
+
+static void issue(const struct request *q, char *buf) {
+
+    const struct trace_record *r = q->r;
+    struct stat sb;
+    struct known *k;
+
+    switch (r->op) {
+
+    case TRACE_LOOKUP:
+        (void)fstatat(job.dirFh, q->name, &sb, 0);
+        break;
+
+    case TRACE_GETATTR:
+        if (r->ino == ROOT_INO)
+            (void)fstat(job.dirFh, &sb);
+        else if ((k = known(r->ino)) && k->fd >= 0)
+            (void)fstat(k->fd, &sb);
+        break;
+
+    case TRACE_READ:
+        if ((k = known(r->ino)) && k->fd >= 0)
+            if (pread(k->fd, buf, r->len, (off_t)r->off) < 0)
+                warn("Reading %s at %zu", k->name, (size_t)r->off);
+        break;
+    }
+}
+
+
+
+/* Replaying thread: issue the requests of one traced thread, from
+   `arg` up to the next thread in the trace. */
+
+static void *worker(void *arg) {
+
+    const struct request *q = arg;
+    uint16_t thread = q->r->thread;
+
+    size_t size = 0;
+    for (const struct request *p = q; p->r && p->r->thread == thread; p++)
+        if (p->r->op == TRACE_READ)
+            size = max(size, p->r->len);
+    char *buf = malloc(max(size, 1));
+    ERRIF(!buf);
+
+    for (; q->r && q->r->thread == thread; q++) {
+        const struct trace_record *r = q->r;
+
+        if (!job.fast) {
+            long due = job.t0 + (long)(r->start - job.first);
+            struct timespec ts = {
+                .tv_sec = due / 1000000000L,
+                .tv_nsec = due % 1000000000L,
+            };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+
+        long start = profile_now();
+        issue(q, buf);
+        __atomic_fetch_add(&job.took[r->op], profile_now() - start,
+                           __ATOMIC_RELAXED);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+
+
+int main(int argc, char **argv) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        switch (opt) {
+        case 'f': job.fast = 1; break;
+        default: errx(1, "%s", usage);
+        }
+    }
+    if (argc - optind != 2)
+        errx(1, "%s", usage);
+
+    const char *traceName = argv[optind];
+
+    job.dirFh = open(argv[optind + 1], O_RDONLY | O_DIRECTORY);
+    if (job.dirFh < 0)
+        err(1, "Failed to open mountpoint %s", argv[optind + 1]);
+
+    /* Map the trace. */
+    struct stat sb;
+    int fd = open(traceName, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb))
+        err(1, "Failed to open trace %s", traceName);
+    size_t size = (size_t)sb.st_size;
+    if (size < sizeof(struct trace_header))
+        errx(1, "Not a trace: %s", traceName);
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ERRIF(data == MAP_FAILED);
+    close(fd);
+
+    const struct trace_header *h = (const void *)data;
+    if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) ||
+        h->version != TRACE_VERSION)
+        errx(1, "Not a trace of this version: %s", traceName);
+
+    /* Collect the requests, and the names of the inodes. */
+    STACK(struct request) requests;
+    ALLOCATE(requests, 1024);
+    ALLOCATE(job.files, 64);
+    job.first = INT64_MAX;
+    size_t threads = 0;
+
+    for (size_t at = sizeof(*h); at < size; ) {
+        const struct trace_record *r = (const void *)(data + at);
+        if (at + sizeof(*r) > size || !r->op || r->op >= OPS)
+            errx(1, "Broken trace at %zu: %s", at, traceName);
+        at += sizeof(*r);
+
+        struct request q = { .r = r, .name = NULL };
+        if (r->op == TRACE_LOOKUP) {
+            size_t padded = ((size_t)r->len + 8) & ~(size_t)7;
+            if (at + padded > size || data[at + r->len])
+                errx(1, "Broken trace at %zu: %s", at, traceName);
+            q.name = data + at;
+            at += padded;
+            if (r->off) {
+                ENOUGH(job.files);
+                PUSH(job.files, ((struct known){ r->off, q.name, -1 }));
+            }
+        }
+
+        ENOUGH(requests);
+        PUSH(requests, q);
+        job.first = min(job.first, r->start);
+        threads = max(threads, (size_t)r->thread + 1);
+        job.count[r->op]++;
+        job.traced[r->op] += r->end - r->start;
+    }
+    if (!requests.used)
+        errx(1, "Empty trace: %s", traceName);
+
+    /* Sort, and terminate the list for `worker`. */
+    qsort(requests.array, requests.used, sizeof(struct request), byThread);
+    ENOUGH(requests);
+    PUSH(requests, ((struct request){ NULL, NULL }));
+
+    /* Open each file once, by one of the names seen for its inode.
+       A file may have been unlinked, or reloaded under a new inode. */
+    qsort(job.files.array, job.files.used, sizeof(struct known), byIno);
+    size_t n = 0;
+    for (size_t i = 0; i < job.files.used; i++) {
+        struct known *k = &AT(job.files, i);
+        if (n && AT(job.files, n - 1).ino == k->ino)
+            continue;
+        k->fd = openat(job.dirFh, k->name, O_RDONLY);
+        if (k->fd < 0)
+            warn("Skipping reads of %s", k->name);
+        AT(job.files, n++) = *k;
+    }
+    job.files.used = n;
+
+    /* One thread per traced thread. */
+    pthread_t *tid = malloc(threads * sizeof(pthread_t));
+    ERRIF(!tid);
+    size_t started = 0;
+
+    job.t0 = profile_now();
+    for (size_t i = 0; i + 1 < requests.used; i++)
+        if (!i || AT(requests, i).r->thread != AT(requests, i - 1).r->thread)
+            ERRIF(pthread_create(&tid[started++], NULL, worker,
+                                 &AT(requests, i)));
+    for (size_t i = 0; i < started; i++)
+        ERRIF(pthread_join(tid[i], NULL));
+
+    double dt = (double)(profile_now() - job.t0) / 1e9;
+
+    printf("%zu requests by %zu threads in %.3fs%s\n", requests.used - 1,
+           started, dt, job.fast ? ", as fast as possible" : "");
+    printf("%-8s %10s %14s %14s\n", "op", "count", "traced/us", "replayed/us");
+    for (int op = 1; op < OPS; op++)
+        if (job.count[op])
+            printf("%-8s %10zu %14.1f %14.1f\n", opName[op], job.count[op],
+                   (double)job.traced[op] / 1e3 / (double)job.count[op],
+                   (double)job.took[op] / 1e3 / (double)job.count[op]);
+
+    for (size_t i = 0; i < job.files.used; i++)
+        if (AT(job.files, i).fd >= 0)
+            close(AT(job.files, i).fd);
+    free(tid);
+    free(requests.array);
+    free(job.files.array);
+    close(job.dirFh);
+
+    return 0;
+}
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "libotffs.h"
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Check that a file served by otffs has exactly the content its
+   definition in the config file promises.  The file is cut into
+   chunks, which are read by several threads in parallel, and compared
+   against the expected content using memcmp(3).  The expected content
+   is produced by the same library otffs uses.  For huge files, only a
+   number of randomly placed ranges may be checked instead.
+
+   The first mismatching offset, or the throughput are reported.
+ */
+
+enum { DEFAULT_CHUNK = 1 << 20, MAX_THREADS = 256 };
+
+static const char *usage =
+    "usage: verify [-j threads] [-b chunk] [-n samples] [-l length]"
+    " [-s seed] [-C srcdir] <config> <file>";
+
+
+
+/* Everything the worker threads share. */
+
+static struct {
+    const char *fileName; // file being verified
+    int fd; // its handle
+    size_t size; // its size
+
+    struct file *fp; // its definition from the config file
+    int srcFh; // for `pass`: handle of the source
+
+    size_t chunk; // amount of data compared at once
+    size_t tasks; // number of chunks or samples
+    size_t samples; // 0: compare the whole file
+    uint64_t seed; // to place samples
+
+    size_t next; // next task to pick, atomically incremented
+    size_t checked; // total bytes compared, atomically incremented
+
+    pthread_mutex_t lock; // protects `mismatch`
+    size_t mismatch; // first offset found to differ, SIZE_MAX if none
+} job;
+
+
+
+/* A simple mixing function, used to place samples. */
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+
+
+/* Return the offset of the first byte where `a` and `b` differ in the
+   first `len` bytes, or `len` if they are equal. */
+
+static size_t firstDiff(const char *a, const char *b, size_t len) {
+    if (!memcmp(a, b, len))
+        return len;
+    size_t i = 0;
+    while (a[i] == b[i])
+        i++;
+    return i;
+}
+
+
+
+/* Compare `len` bytes read from offset `off` into `buf` with the
+   expected content, produced in `tmp`.  Returns the number of
+   matching bytes. */
+
+static size_t compare(size_t off, size_t len, const char *buf, char *tmp) {
+    otffs_fill(job.fp, job.srcFh, off, len, tmp);
+    return firstDiff(buf, tmp, len);
+}
+
+
+
+/* Report a mismatch at offset `off`, unless an earlier one is known. */
+
+static void mismatch(size_t off) {
+    ERRIF(pthread_mutex_lock(&job.lock));
+    job.mismatch = min(job.mismatch, off);
+    ERRIF(pthread_mutex_unlock(&job.lock));
+}
+
+
+
+/* Determine the range to check for task `t`.  Returns 0 if there is
+   nothing to do. */
+
+static int task(size_t t, size_t *off, size_t *len) {
+
+    if (job.samples) {
+        size_t l = min(job.chunk, job.size);
+        *off = job.size > l ? splitmix64(job.seed + t) % (job.size - l + 1) : 0;
+        *len = l;
+    } else {
+        *off = t * job.chunk;
+        *len = min(job.chunk, job.size - *off);
+    }
+
+    return *len > 0;
+}
+
+
+
+/* Worker thread: pick tasks until all are done, or a mismatch is
+   found that precedes all remaining tasks. */
+
+static void *worker(void *arg) {
+    (void)arg;
+
+    char *buf = malloc(job.chunk), *tmp = malloc(job.chunk);
+    ERRIF(!buf || !tmp);
+
+    size_t t;
+    while ((t = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED))
+           < job.tasks) {
+
+        size_t off, len;
+        if (!task(t, &off, &len))
+            continue;
+
+        /* In full mode, tasks are in ascending order.  No need to
+           look past a known mismatch. */
+        if (!job.samples &&
+            off >= __atomic_load_n(&job.mismatch, __ATOMIC_RELAXED))
+            break;
+
+        size_t got = 0;
+        while (got < len) {
+            ssize_t r = pread(job.fd, buf + got, len - got,
+                              (off_t)(off + got));
+            if (r < 0)
+                err(1, "Reading %s at %zu", job.fileName, off + got);
+            if (r == 0)
+                break;
+            got += (size_t)r;
+        }
+
+        size_t ok = compare(off, got, buf, tmp);
+        __atomic_fetch_add(&job.checked, ok, __ATOMIC_RELAXED);
+        if (ok < len)
+            mismatch(off + ok);
+    }
+
+    free(buf);
+    free(tmp);
+    return NULL;
+}
+
+
+
+static double now(void) {
+    struct timespec ts;
+    ERRIF(clock_gettime(CLOCK_MONOTONIC, &ts));
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+
+int main(int argc, char **argv) {
+
+    size_t threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *srcDir = NULL;
+
+    job.chunk = DEFAULT_CHUNK;
+    job.seed = (uint64_t)time(NULL);
+    job.mismatch = SIZE_MAX;
+    ERRIF(pthread_mutex_init(&job.lock, NULL));
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:b:n:l:s:C:")) != -1) {
+        switch (opt) {
+        case 'j': threads = strtoul(optarg, NULL, 10); break;
+        case 'b':
+        case 'l': job.chunk = strtoul(optarg, NULL, 10); break;
+        case 'n': job.samples = strtoul(optarg, NULL, 10); break;
+        case 's': job.seed = strtoull(optarg, NULL, 10); break;
+        case 'C': srcDir = optarg; break;
+        default: errx(1, "%s", usage);
+        }
+    }
+    if (argc - optind != 2 || !job.chunk)
+        errx(1, "%s", usage);
+    threads = max(1, min(threads, MAX_THREADS));
+
+    const char *config = argv[optind];
+    job.fileName = argv[optind + 1];
+
+    { /* Find the definition of the file in the config file.
+         Sources are located relative to the file unless specified
+         otherwise. */
+        char *dir = strdup(job.fileName);
+        ERRIF(!dir);
+        int rootFh = open(srcDir ? srcDir : dirname(dir),
+                          O_RDONLY | O_DIRECTORY);
+        if (rootFh < 0)
+            err(1, "Failed to open source directory");
+        free(dir);
+
+        int fd = open(config, O_RDONLY);
+        if (fd < 0)
+            err(1, "Failed to open config file: %s", config);
+
+        struct fileSystem fs;
+        otffs_load(&fs, rootFh, fd, time(NULL), 0); // closes `fd`
+
+        char *name = strdup(job.fileName);
+        ERRIF(!name);
+        size_t ino;
+        if (!avl_lookup(fs.names, basename(name), &ino))
+            errx(1, "No definition of `%s` in %s", basename(name), config);
+        job.fp = AT(fs.files, ino);
+        free(name);
+
+        int e = otffs_ready(&fs, job.fp);
+        if (e) {
+            errno = e;
+            err(1, "Cannot gather metadata of `%s`", job.fileName);
+        }
+
+        job.srcFh = -1;
+        if (job.fp->srcName) {
+            job.srcFh = openat(rootFh, job.fp->srcName, O_RDONLY);
+            if (job.srcFh < 0)
+                err(1, "Failed to open source `%s`", job.fp->srcName);
+        }
+        close(rootFh);
+    }
+
+    { /* Open the file to verify. */
+        struct stat sb;
+        job.fd = open(job.fileName, O_RDONLY);
+        if (job.fd < 0)
+            err(1, "Failed to open %s", job.fileName);
+        ERRIF(fstat(job.fd, &sb));
+        job.size = (size_t)sb.st_size;
+    }
+
+    job.tasks = job.samples ? job.samples
+        : (job.size + job.chunk - 1) / job.chunk;
+
+    double t0 = now();
+
+    pthread_t tid[MAX_THREADS];
+    for (size_t i = 0; i < threads; i++)
+        ERRIF(pthread_create(&tid[i], NULL, worker, NULL));
+    for (size_t i = 0; i < threads; i++)
+        ERRIF(pthread_join(tid[i], NULL));
+
+    double dt = now() - t0;
+
+    if (job.mismatch != SIZE_MAX)
+        errx(1, "Difference at %zu in %s", job.mismatch, job.fileName);
+
+    printf("%s: %zu bytes OK in %.3fs (%.1f MiB/s)\n", job.fileName,
+           job.checked, dt, (double)job.checked / (1 << 20) / max(dt, 1e-9));
+
+    if (job.srcFh >= 0)
+        close(job.srcFh);
+    close(job.fd);
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "profile.h"
+#include "trace.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/* See `trace.h` for documentation.
+
+   Buffers are written whole, under a lock, so records of different
+   threads do not mix.  All buffers are kept in a list, to write them
+   when tracing stops. */
+
+enum { BUF_SIZE = 1 << 16 };
+
+struct buffer {
+    struct buffer *prev, *next; // list of all buffers
+    uint16_t thread;
+    size_t used;
+    char data[BUF_SIZE];
+};
+
+static struct {
+    int fd; // -1 if not tracing
+    pthread_key_t key; // buffer of the calling thread
+    pthread_mutex_t lock; // protects the list, and writing
+    struct buffer *all; // list of all buffers
+    uint16_t threads; // number of buffers ever created
+} trace = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+
+/* Write the records in buffer `b` to the trace file, or drop them if
+   tracing has stopped.  The caller must hold the lock. */
+
+static void flush(struct buffer *b) {
+    for (size_t done = 0; trace.fd >= 0 && done < b->used; ) {
+        ssize_t n = write(trace.fd, b->data + done, b->used - done);
+        ERRIF(n < 0);
+        done += (size_t)n;
+    }
+    b->used = 0;
+}
+
+/* Called when a thread terminates: Write its buffer, and free it. */
+
+static void release(void *arg) {
+    struct buffer *b = arg;
+    ERRIF(pthread_mutex_lock(&trace.lock));
+    flush(b);
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        trace.all = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    ERRIF(pthread_mutex_unlock(&trace.lock));
+    free(b);
+}
+
+/* Return the buffer of the calling thread, creating it if necessary. */
+
+static struct buffer *buffer(void) {
+    struct buffer *b = pthread_getspecific(trace.key);
+    if (b)
+        return b;
+
+    b = new(struct buffer);
+    b->prev = NULL;
+    b->used = 0;
+    ERRIF(pthread_mutex_lock(&trace.lock));
+    b->thread = trace.threads++;
+    b->next = trace.all;
+    if (b->next)
+        b->next->prev = b;
+    trace.all = b;
+    ERRIF(pthread_mutex_unlock(&trace.lock));
+
+    ERRIF(pthread_setspecific(trace.key, b));
+    return b;
+}
+
+
+
+void trace_start(int fd) {
+    struct trace_header h = { .version = TRACE_VERSION };
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    ERRIF(write(fd, &h, sizeof(h)) != sizeof(h));
+    ERRIF(pthread_key_create(&trace.key, release));
+    trace.fd = fd;
+}
+
+
+
+void trace_stop(void) {
+    if (trace.fd < 0)
+        return;
+    ERRIF(pthread_mutex_lock(&trace.lock));
+    for (struct buffer *b = trace.all; b; b = b->next)
+        flush(b);
+    close(trace.fd);
+    trace.fd = -1;
+    ERRIF(pthread_mutex_unlock(&trace.lock));
+}
+
+
+
+long trace_now(void) {
+    return trace.fd < 0 ? 0 : profile_now();
+}
+
+
+
+void trace_add(enum trace_op op, uint64_t ino, uint64_t off, size_t len,
+               const char *name, long start) {
+
+    if (! start)
+        return;
+
+    struct buffer *b = buffer();
+
+    size_t nameLen = name ? strlen(name) : 0;
+    size_t padded = (nameLen + 8) & ~(size_t)7;
+    if (b->used + sizeof(struct trace_record) + padded > BUF_SIZE) {
+        ERRIF(pthread_mutex_lock(&trace.lock));
+        flush(b);
+        ERRIF(pthread_mutex_unlock(&trace.lock));
+    }
+
+    struct trace_record r = {
+        .start = start,
+        .end = profile_now(),
+        .ino = ino,
+        .off = off,
+        .len = (uint32_t)(name ? nameLen : min(len, UINT32_MAX)),
+        .op = (uint16_t)op,
+        .thread = b->thread,
+    };
+    memcpy(b->data + b->used, &r, sizeof(r));
+    b->used += sizeof(r);
+
+    if (name) {
+        memset(b->data + b->used, 0, padded);
+        memcpy(b->data + b->used, name, nameLen);
+        b->used += padded;
+    }
+}
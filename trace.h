@@ -0,0 +1,58 @@
+/* Tracing of requests served by otffs, to replay them later with
+   `tools/replay`.  Each thread collects records in a buffer of its
+   own, which is appended to the trace file when full, when the thread
+   terminates, and when tracing stops.
+
+   A trace file is a `struct trace_header`, followed by records in no
+   particular order between threads, but in order for each thread.  A
+   record of a lookup is followed by the looked up name, terminated and
+   padded with NUL to a multiple of 8 bytes. */
+
+#ifndef trace_Vb7nQ2kXwT4e
+#define trace_Vb7nQ2kXwT4e
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC "otffstrc"
+#define TRACE_VERSION 1
+
+enum trace_op { TRACE_LOOKUP = 1, TRACE_GETATTR, TRACE_READ };
+
+struct trace_header {
+    char magic[8]; // TRACE_MAGIC, not terminated
+    uint64_t version; // TRACE_VERSION
+};
+
+struct trace_record {
+    int64_t start, end; // ns, see `profile_now`
+    uint64_t ino; // of the file, or the parent for lookups
+    uint64_t off; // of reads, or the inode found by lookups, 0 if none
+    uint32_t len; // of reads, or of the name following lookups
+    uint16_t op; // see `enum trace_op`
+    uint16_t thread; // number of the thread, in order of first request
+};
+
+/* Start tracing to file handle `fd`, writing the header.  Terminates
+   the program on failure. */
+
+void trace_start(int fd);
+
+/* Stop tracing, writing all records collected so far.  The file
+   handle is closed. */
+
+void trace_stop(void);
+
+/* Return the current time for the start of a record, or 0 if not
+   tracing. */
+
+long trace_now(void);
+
+/* Add a record of a request that arrived at `start`, returned by
+   `trace_now`, and has been answered now.  `name` is the name looked
+   up, `NULL` for other requests.  Does nothing if `start` is 0. */
+
+void trace_add(enum trace_op op, uint64_t ino, uint64_t off, size_t len,
+               const char *name, long start);
+
+#endif
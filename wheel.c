@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "profile.h"
+#include "wheel.h"
+#include <pthread.h>
+#include <time.h>
+
+/* See `wheel.h` for documentation.
+
+   A hashed timer wheel: Time is cut into ticks, and each timer is put
+   in the slot for its tick, modulo the number of slots.  The thread
+   visits one slot per tick, and runs the timers that are due.  Timers
+   further in the future than one turn of the wheel just stay in their
+   slot for more turns. */
+
+enum {
+    SLOTS = 1 << 12,
+    TICK = 250000, // ns
+};
+
+struct timer {
+    long due;
+    wheel_Fun fun;
+    void *arg;
+    struct timer *next;
+};
+
+static struct {
+    pthread_mutex_t lock; // protects all of this
+    pthread_cond_t wake; // signalled when the wheel is no longer empty
+    struct timer *slot[SLOTS];
+    long cursor; // the next tick to visit
+    size_t pending; // number of timers in the wheel
+    int stopping; // run all timers now, then end, see `wheel_stop`
+} wheel = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_t thread; // running the wheel
+
+
+
+void wheel_at(long due, wheel_Fun fun, void *arg) {
+
+    struct timer *t = new(struct timer);
+    *t = (struct timer){ .due = due, .fun = fun, .arg = arg };
+
+    ERRIF(pthread_mutex_lock(&wheel.lock));
+
+    /* An idle wheel has not been turning. */
+    if (! wheel.pending)
+        wheel.cursor = profile_now() / TICK;
+
+    /* Timers already due go into the next slot visited. */
+    long tick = max(due / TICK, wheel.cursor);
+    t->next = wheel.slot[tick % SLOTS];
+    wheel.slot[tick % SLOTS] = t;
+
+    if (! wheel.pending++)
+        ERRIF(pthread_cond_signal(&wheel.wake));
+
+    ERRIF(pthread_mutex_unlock(&wheel.lock));
+}
+
+
+
+static void *run(void *arg) {
+    (void)arg;
+
+    ERRIF(pthread_mutex_lock(&wheel.lock));
+
+    for (;;) {
+
+        while (! wheel.pending && ! wheel.stopping)
+            ERRIF(pthread_cond_wait(&wheel.wake, &wheel.lock));
+        if (! wheel.pending)
+            break;
+
+        /* Wait for the tick of the next slot to pass. */
+        if (! wheel.stopping && wheel.cursor >= profile_now() / TICK) {
+            long t = (wheel.cursor + 1) * TICK;
+            struct timespec ts = {
+                .tv_sec = t / 1000000000L,
+                .tv_nsec = t % 1000000000L,
+            };
+            ERRIF(pthread_mutex_unlock(&wheel.lock));
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            ERRIF(pthread_mutex_lock(&wheel.lock));
+            continue;
+        }
+
+        /* Take the due timers out of the slot. */
+        struct timer *ready = NULL;
+        for (struct timer **p = &wheel.slot[wheel.cursor % SLOTS]; *p; ) {
+            if (wheel.stopping || (*p)->due / TICK <= wheel.cursor) {
+                struct timer *t = *p;
+                *p = t->next;
+                t->next = ready;
+                ready = t;
+                wheel.pending--;
+            } else {
+                p = &(*p)->next;
+            }
+        }
+        wheel.cursor++;
+
+        /* Run them without holding the lock. */
+        ERRIF(pthread_mutex_unlock(&wheel.lock));
+        while (ready) {
+            struct timer *t = ready;
+            ready = t->next;
+            t->fun(t->arg);
+            free(t);
+        }
+        ERRIF(pthread_mutex_lock(&wheel.lock));
+    }
+
+    ERRIF(pthread_mutex_unlock(&wheel.lock));
+    return NULL;
+}
+
+
+
+void wheel_start(void) {
+    ERRIF(pthread_create(&thread, NULL, run, NULL));
+}
+
+void wheel_stop(void) {
+    ERRIF(pthread_mutex_lock(&wheel.lock));
+    wheel.stopping = 1;
+    ERRIF(pthread_cond_signal(&wheel.wake));
+    ERRIF(pthread_mutex_unlock(&wheel.lock));
+    ERRIF(pthread_join(thread, NULL));
+}
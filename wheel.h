@@ -0,0 +1,27 @@
+/* A timer wheel, running callbacks at given points in time on a
+   dedicated thread.  Used to defer replies without blocking the
+   threads serving FUSE requests, so many requests with emulated
+   latency can be in flight at the same time. */
+
+#ifndef wheel_Pq8sLm3YxRdk
+#define wheel_Pq8sLm3YxRdk
+
+typedef void (*wheel_Fun)(void *arg);
+
+/* Start the thread running the wheel.  Terminates the program on
+   failure. */
+
+void wheel_start(void);
+
+/* Call `fun(arg)` at time `due`, or as soon as possible after that.
+   Times are in ns, see `profile_now`.  Callbacks are called one after
+   another, and should not block. */
+
+void wheel_at(long due, wheel_Fun fun, void *arg);
+
+/* Call all pending callbacks right away, and end the thread.  The
+   wheel must not be used after that. */
+
+void wheel_stop(void);
+
+#endif